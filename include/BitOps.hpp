@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// number of leading zero bits of a 32 bit value, x must not be 0
+inline int countLeadingZeros(uint32_t x) {
+    assert(x != 0);
+#ifdef _MSC_VER
+    unsigned long idx;
+    _BitScanReverse(&idx, x);
+    return 31 - static_cast<int>(idx);
+#else
+    return __builtin_clz(x);
+#endif
+}
+
+// number of trailing zero bits of a 64 bit value, x must not be 0
+inline int countTrailingZeros(uint64_t x) {
+    assert(x != 0);
+#if defined(_MSC_VER) && defined(_M_X64)
+    unsigned long idx;
+    _BitScanForward64(&idx, x);
+    return static_cast<int>(idx);
+#elif defined(_MSC_VER)
+    unsigned long idx;
+    if (_BitScanForward(&idx, static_cast<uint32_t>(x)))
+        return static_cast<int>(idx);
+    _BitScanForward(&idx, static_cast<uint32_t>(x >> 32));
+    return static_cast<int>(idx) + 32;
+#else
+    return __builtin_ctzll(x);
+#endif
+}
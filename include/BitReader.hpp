@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstddef>
+
+// reads bits (MSB first) from a byte span through a 64 bit buffer that is refilled up to 8 bytes at a time.
+// in jpeg_mode the 0x00 stuffed after every 0xFF is dropped and a marker (0xFF followed by anything else) ends the data.
+// reading behind the end of the data gives 1s, like the padding of the last byte of a scan
+class BitReader {
+public:
+    BitReader(const uint8_t* data, size_t size, bool jpeg_mode = false)
+        : data(data), size(size), pos(0), jpeg_mode(jpeg_mode),
+        buffer(0), bit_count(0), consumed(0), padding(0), found_marker(0)
+    {}
+
+    // the next number_of_bits (up to 32) bits without consuming them, right aligned
+    uint32_t peek(int number_of_bits) {
+        assert(number_of_bits >= 0 && number_of_bits <= 32);
+        if (bit_count < number_of_bits)
+            refill();
+        if (number_of_bits == 0)
+            return 0;
+        return static_cast<uint32_t>(buffer >> (64 - number_of_bits));
+    }
+
+    void skip(int number_of_bits) {
+        assert(number_of_bits >= 0 && number_of_bits <= 32);
+        if (bit_count < number_of_bits)
+            refill();
+        buffer <<= number_of_bits;
+        bit_count -= number_of_bits;
+        consumed += number_of_bits;
+    }
+
+    uint32_t read(int number_of_bits) {
+        auto bits = peek(number_of_bits);
+        skip(number_of_bits);
+        return bits;
+    }
+
+    // number of consumed bits (without stuffed bytes)
+    size_t position() const { return consumed; }
+
+    // true if all data bits are consumed (in jpeg_mode up to the marker)
+    bool atEnd() {
+        if (bit_count == 0)
+            refill();
+        return bit_count <= padding;
+    }
+
+    // second byte of the marker that ended the data, 0 if none was found (yet)
+    uint8_t marker() const { return found_marker; }
+
+private:
+    void refill() {
+        // fast path: 8 bytes at once if there is no 0xFF among them (or no stuffing to care about)
+        if (pos + 8 <= size && found_marker == 0) {
+            uint64_t word = 0;
+            for (int i = 0; i < 8; ++i)
+                word = (word << 8) | data[pos + i];
+
+            auto inverted = ~word;
+            bool has_0xFF = ((inverted - 0x0101010101010101ULL) & ~inverted & 0x8080808080808080ULL) != 0;
+            if (!jpeg_mode || !has_0xFF) {
+                // only whole bytes are taken, the bits of the next byte that slip in are the same as when it's read later
+                int bytes = (64 - bit_count) / 8;
+                buffer |= word >> bit_count;
+                bit_count += 8 * bytes;
+                pos += bytes;
+                return;
+            }
+        }
+
+        while (bit_count <= 56) {
+            buffer |= static_cast<uint64_t>(nextByte()) << (56 - bit_count);
+            bit_count += 8;
+        }
+    }
+
+    uint8_t nextByte() {
+        if (pos >= size || found_marker != 0) {
+            padding += 8;
+            return 0xFF;
+        }
+
+        auto byte = data[pos++];
+        if (jpeg_mode && byte == 0xFF) {
+            if (pos < size && data[pos] == 0x00) {
+                ++pos; // stuffed byte
+            }
+            else {
+                // a marker, there is no more data
+                found_marker = pos < size ? data[pos] : 0xFF;
+                --pos;
+                padding += 8;
+                return 0xFF;
+            }
+        }
+        return byte;
+    }
+
+    const uint8_t* data;
+    size_t size;
+    size_t pos;         // next byte to put into the buffer
+    bool jpeg_mode;
+
+    uint64_t buffer;    // the bit_count highest bits are valid
+    int bit_count;
+    size_t consumed;
+    int padding;        // bits in the buffer that were filled in behind the end of the data
+    uint8_t found_marker;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "ByteStuffing.hpp"
+
+// writer for the entropy coded segment of a jpeg: bits are collected in a 64 bit register and written out
+// 32 bits at a time, a 0x00 byte is stuffed after every 0xFF byte on the way (unless stuffing is off,
+// for parts of a scan that are put together and stuffed later).
+// push_back_LSB_mode has the same meaning as in Bitstream_Generic, so both work with encodeBlock
+class BitWriter {
+public:
+    explicit BitWriter(size_t expected_bytes = 0, bool stuffing = true)
+        : accumulator(0), bit_count(0), bits_written(0), pos(0), stuffing(stuffing)
+    {
+        buffer.resize(expected_bytes + 16);
+    }
+
+    // starts over, the buffer is kept for the next stream
+    void clear() {
+        accumulator = 0;
+        bit_count = 0;
+        bits_written = 0;
+        pos = 0;
+    }
+
+    // append the number_of_bits lowest bits of data, the highest of them first
+    void push_back_LSB_mode(uint32_t data, int number_of_bits) {
+        assert(number_of_bits >= 0 && number_of_bits <= 32);
+
+        accumulator = (accumulator << number_of_bits) | (data & ((1ULL << number_of_bits) - 1));
+        bit_count += number_of_bits;
+        bits_written += number_of_bits;
+
+        if (bit_count >= 32)
+            flushWord();
+    }
+
+    // pad the last byte with 1s (like Bitstream_Generic::fill) and write out everything
+    void flush() {
+        auto padding = (8 - bit_count % 8) % 8;
+        accumulator = (accumulator << padding) | ((1U << padding) - 1);
+        bit_count += padding;
+
+        reserve(8);
+        while (bit_count > 0) {
+            bit_count -= 8;
+            putByte(static_cast<uint8_t>(accumulator >> bit_count));
+        }
+        accumulator = 0;
+    }
+
+    // a marker like RSTn (0xFF, marker) without stuffing, only after flush
+    void writeMarker(uint8_t marker) {
+        assert(bit_count == 0);
+        reserve(2);
+        buffer[pos++] = 0xFF;
+        buffer[pos++] = marker;
+    }
+
+    // appends the bytes of another writer, both have to be flushed
+    void append(const BitWriter& other) {
+        assert(bit_count == 0 && other.bit_count == 0);
+        reserve(other.pos);
+        if (other.pos > 0)
+            std::memcpy(&buffer[pos], other.buffer.data(), other.pos);
+        pos += other.pos;
+        bits_written += other.bits_written;
+    }
+
+    // appends whole bytes of entropy coded data and stuffs them, only after flush
+    void writeBytes(const uint8_t* data, size_t size) {
+        assert(bit_count == 0);
+        reserve(2 * size);
+        if (stuffing) {
+            pos += stuffBytes(data, size, &buffer[pos]);
+        }
+        else {
+            if (size > 0)
+                std::memcpy(&buffer[pos], data, size);
+            pos += size;
+        }
+        bits_written += 8 * size;
+    }
+
+    // the stuffed bytes written so far, call flush first to get all of them
+    const uint8_t* data() const { return buffer.data(); }
+    size_t byteCount() const { return pos; }
+
+    // number of bits pushed so far (without padding and stuffing)
+    size_t size() const { return bits_written; }
+
+private:
+    void flushWord() {
+        bit_count -= 32;
+        auto word = static_cast<uint32_t>(accumulator >> bit_count);
+
+        reserve(8);
+        // most words don't contain a 0xFF byte: (~word) has a zero byte exactly where word has a 0xFF byte
+        auto inverted = ~word;
+        if (!stuffing || ((inverted - 0x01010101U) & ~inverted & 0x80808080U) == 0) {
+            buffer[pos]     = static_cast<uint8_t>(word >> 24);
+            buffer[pos + 1] = static_cast<uint8_t>(word >> 16);
+            buffer[pos + 2] = static_cast<uint8_t>(word >> 8);
+            buffer[pos + 3] = static_cast<uint8_t>(word);
+            pos += 4;
+        }
+        else {
+            putByte(static_cast<uint8_t>(word >> 24));
+            putByte(static_cast<uint8_t>(word >> 16));
+            putByte(static_cast<uint8_t>(word >> 8));
+            putByte(static_cast<uint8_t>(word));
+        }
+    }
+
+    void putByte(uint8_t byte) {
+        buffer[pos++] = byte;
+        if (byte == 0xFF && stuffing)
+            buffer[pos++] = 0x00;
+    }
+
+    // room for at least the given number of bytes at pos
+    void reserve(size_t bytes) {
+        if (pos + bytes > buffer.size())
+            buffer.resize(2 * buffer.size() + bytes);
+    }
+
+    uint64_t accumulator;       // the lowest bit_count bits are pending
+    int bit_count;              // < 32 between calls
+    size_t bits_written;
+    std::vector<uint8_t> buffer;
+    size_t pos;
+    bool stuffing;
+};
@@ -6,6 +6,9 @@
 #include <ostream>
 #include <istream>
 #include <cassert>
+#include <cstring>
+
+#include "ByteStuffing.hpp"
 
 // Bitstream_Generic[0] is the least significant bit (LSB)
 // Bitsream[Bitstream_Generic.size()-1] is the most significant bit (MSB)
@@ -73,7 +76,7 @@ public:
     // appending bits / bitstreams
     Bitstream_Generic& operator<<(bool val);
     Bitstream_Generic& operator<<(std::initializer_list<bool> args);
-    Bitstream_Generic& operator<<(Bitstream_Generic<BlockType>& stream);
+    Bitstream_Generic& operator<<(const Bitstream_Generic<BlockType>& stream); // shifts whole blocks
     Bitstream_Generic& push_back(bool val);
     Bitstream_Generic& push_back(uint32_t data, int number_of_bits);
     Bitstream_Generic& push_back_LSB_mode(uint32_t data, int number_of_bits);
@@ -89,8 +92,11 @@ public:
 
     // bit at from_position will be the MSB
     template<typename T>
-    T extractT(uint8_t number_of_bits, size_t from_position);
-    uint32_t extract(uint8_t number_of_bits, size_t from_position) { return extractT<uint32_t>(number_of_bits, from_position); }
+    T extractT(uint8_t number_of_bits, size_t from_position) const;
+    uint32_t extract(uint8_t number_of_bits, size_t from_position) const { return extractT<uint32_t>(number_of_bits, from_position); }
+
+    // all blocks as bytes, the first bit is the MSB of the first byte
+    std::vector<uint8_t> bytes() const;
 
     // others
     unsigned int size() const;
@@ -164,11 +170,41 @@ Bitstream_Generic<BlockType>& Bitstream_Generic<BlockType>::operator<<(std::init
 }
 
 template<typename BlockType>
-Bitstream_Generic<BlockType>& Bitstream_Generic<BlockType>::operator<<(Bitstream_Generic<BlockType>& stream)
+Bitstream_Generic<BlockType>& Bitstream_Generic<BlockType>::operator<<(const Bitstream_Generic<BlockType>& stream)
 {
-    for (auto i = 0U; i < stream.size(); ++i) {
-        *this << stream[i];
+    if (stream.sz == 0)
+        return *this;
+    if (&stream == this) {
+        auto copy = stream;
+        return *this << copy;
+    }
+
+    // bits used in our last block, the blocks of stream are split at that offset
+    const auto offset = sz % block_size;
+    if (offset == 0) {
+        blocks.insert(blocks.end(), stream.blocks.begin(), stream.blocks.end());
     }
+    else {
+        blocks.reserve(blocks.size() + stream.blocks.size());
+        for (auto block : stream.blocks) {
+            blocks.back() |= static_cast<BlockType>(block >> offset);
+            blocks.push_back(static_cast<BlockType>(block << (block_size - offset)));
+        }
+    }
+
+    sz += stream.sz;
+    blocks.resize((sz + block_size - 1) / block_size);
+
+    const auto used = sz % block_size;
+    if (used == 0) {
+        bit_idx = 255; // last block is full, like after the wrap around in operator<<(bool)
+    }
+    else {
+        bit_idx = static_cast<uint8_t>(block_size - 1 - used);
+        // clear whatever stream had behind its last bit
+        blocks.back() &= ~((static_cast<BlockType>(1) << (block_size - used)) - 1);
+    }
+
     return *this;
 }
 
@@ -198,13 +234,9 @@ template<typename BlockType>
 Bitstream_Generic<BlockType>& Bitstream_Generic<BlockType>::push_back_LSB_mode(uint32_t data, int number_of_bits)
 {
     // append number_of_bits from LSB
-    unsigned int mask = 1 << (number_of_bits - 1);
-    while (number_of_bits > 0) {
-        bool bit = (data & mask) != 0;
+    for (auto i = number_of_bits - 1; i >= 0; --i) {
+        bool bit = ((data >> i) & 1) != 0;
         *this << bit;
-
-        --number_of_bits;
-        mask >>= 1;
     }
     return *this;
 }
@@ -213,26 +245,53 @@ Bitstream_Generic<BlockType>& Bitstream_Generic<BlockType>::push_back_LSB_mode(u
 template<typename BlockType>
 std::ostream& operator<<(std::ostream& out, const Bitstream_Generic<BlockType>& bitstream)
 {
-    if (bitstream.sz > 0) {
-        for (const auto& block : bitstream.blocks) {
-            out.write((const char*)&block, sizeof(block));
-            if (block == 0xFF)
-                out.put(0x00);
-        }
-    }
+    if (bitstream.sz == 0)
+        return out;
+
+    const auto bytes = bitstream.bytes();
+    const auto byte_count = bytes.size();
+
+    // byte stuffing for the jpeg scan, worst case every byte is 0xFF
+    std::vector<uint8_t> stuffed(2 * byte_count);
+    auto stuffed_size = stuffBytes(bytes.data(), byte_count, stuffed.data());
+    out.write(reinterpret_cast<const char*>(stuffed.data()), stuffed_size);
+
     return out;
 }
 
 template<typename BlockType>
 std::istream& operator>>(std::istream& in, Bitstream_Generic<BlockType>& bitstream)
 {
-    BlockType b = 0;
-    // only reads sizeof(b) bytes, if the istream was not aligned to that, the rest is ignored
-    while (in.read((char*) &b, sizeof(b)))
+    // only reads sizeof(BlockType) bytes at once, if the istream was not aligned to that, the rest is ignored
+    uint8_t bytes[sizeof(BlockType)];
+    while (in.read(reinterpret_cast<char*>(bytes), sizeof(bytes))) {
+        BlockType b = 0;
+        for (auto byte : bytes)
+            b = static_cast<BlockType>((b << 8) | byte);
         bitstream << b;
+    }
     return in;
 }
 
+template<typename BlockType>
+std::vector<uint8_t> Bitstream_Generic<BlockType>::bytes() const
+{
+    const auto byte_count = blocks.size() * sizeof(BlockType);
+    std::vector<uint8_t> result(byte_count);
+    if (sizeof(BlockType) == 1) {
+        if (byte_count > 0)
+            std::memcpy(result.data(), blocks.data(), byte_count);
+    }
+    else {
+        auto* dst = result.data();
+        for (auto block : blocks) {
+            for (int shift = block_size - 8; shift >= 0; shift -= 8)
+                *dst++ = static_cast<uint8_t>(block >> shift);
+        }
+    }
+    return result;
+}
+
 template<typename BlockType>
 unsigned int Bitstream_Generic<BlockType>::size() const
 {
@@ -263,7 +322,7 @@ typename Bitstream_Generic<BlockType>::BitView Bitstream_Generic<BlockType>::ope
 
 template<typename BlockType>
 template<typename T>
-T Bitstream_Generic<BlockType>::extractT(uint8_t number_of_bits, size_t from_position)
+T Bitstream_Generic<BlockType>::extractT(uint8_t number_of_bits, size_t from_position) const
 {
     assert(number_of_bits <= sizeof(T)*8);
     assert(from_position + number_of_bits - 1 < size());
@@ -273,7 +332,7 @@ T Bitstream_Generic<BlockType>::extractT(uint8_t number_of_bits, size_t from_pos
     auto block_idx = from_position / block_size;
 
     while (number_of_bits > 0) {
-        auto& block = blocks[block_idx];
+        const auto& block = blocks[block_idx];
 
         uint8_t bit_idx_from = block_size - (from_position % block_size) - 1;
 
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
+#include "BitOps.hpp"
+
+// position of the first 0xFF byte in data[from, size), size if there is none
+inline size_t findNext0xFF(const uint8_t* data, size_t from, size_t size) {
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    const auto ones = _mm_set1_epi8(static_cast<char>(0xFF));
+    for (; from + 16 <= size; from += 16) {
+        auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + from));
+        auto mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, ones));
+        if (mask != 0)
+            return from + countTrailingZeros(static_cast<uint64_t>(mask));
+    }
+#endif
+    for (; from < size; ++from) {
+        if (data[from] == 0xFF)
+            return from;
+    }
+    return size;
+}
+
+// jpeg byte stuffing: copies size bytes from src to dst and inserts a 0x00 after every 0xFF.
+// dst needs room for 2 * size bytes in the worst case, returns the number of bytes written
+inline size_t stuffBytes(const uint8_t* src, size_t size, uint8_t* dst) {
+    size_t written = 0;
+    size_t pos = 0;
+
+    while (pos < size) {
+        // the runs between two 0xFF bytes are copied as they are
+        auto next = findNext0xFF(src, pos, size);
+        std::memcpy(dst + written, src + pos, next - pos);
+        written += next - pos;
+
+        if (next == size)
+            break;
+
+        dst[written++] = 0xFF;
+        dst[written++] = 0x00;
+        pos = next + 1;
+    }
+
+    return written;
+}
@@ -4,9 +4,15 @@
 #include <cassert>
 #include <utility>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#endif
+
 #include <boost/numeric/ublas/matrix.hpp>
 
 #include "BitstreamGeneric.hpp"
+#include "BitOps.hpp"
+#include "Huffman.hpp"
 
 using boost::numeric::ublas::matrix;
 typedef double PixelDataType;
@@ -27,28 +33,39 @@ matrix<T> from_vector(const std::vector<T>& v) {
     return m;
 }
 
-template <typename T>
-std::vector<T> zigzag(matrix<T> m) {
-    const auto lookup = from_vector<uint>({
-        0, 1, 5, 6, 14, 15, 27, 28,
-        2, 4, 7, 13, 16, 26, 29, 42,
-        3, 8, 12, 17, 25, 30, 41, 43,
-        9, 11, 18, 24, 31, 40, 44, 53,
-        10, 19, 23, 32, 39, 45, 52, 54,
-        20, 22, 33, 38, 46, 51, 55, 60,
-        21, 34, 37, 47, 50, 56, 59, 61,
-        35, 36, 48, 49, 57, 58, 62, 63
-    });
+// zigzag_order[i] is the row major index of the i-th coefficient in zigzag order
+const Byte zigzag_order[64] = {
+     0,  1,  8, 16,  9,  2,  3, 10,
+    17, 24, 32, 25, 18, 11,  4,  5,
+    12, 19, 26, 33, 40, 48, 41, 34,
+    27, 20, 13,  6,  7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36,
+    29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46,
+    53, 60, 61, 54, 47, 55, 62, 63
+};
+
+// zigzag_index[i] is the zigzag position of the row major index i (inverse of zigzag_order)
+const Byte zigzag_index[64] = {
+     0,  1,  5,  6, 14, 15, 27, 28,
+     2,  4,  7, 13, 16, 26, 29, 42,
+     3,  8, 12, 17, 25, 30, 41, 43,
+     9, 11, 18, 24, 31, 40, 44, 53,
+    10, 19, 23, 32, 39, 45, 52, 54,
+    20, 22, 33, 38, 46, 51, 55, 60,
+    21, 34, 37, 47, 50, 56, 59, 61,
+    35, 36, 48, 49, 57, 58, 62, 63
+};
 
+template <typename T>
+std::vector<T> zigzag(const matrix<T>& m) {
     assert(m.size1() == 8);
     assert(m.size2() == 8);
     std::vector<T> r;
     r.resize(64);
 
-    for (uint i = 0; i < 8; ++i) {
-        for (uint j = 0; j < 8; ++j)
-            r[lookup(i, j)] = m(i, j);
-    }
+    for (uint i = 0; i < 64; ++i)
+        r[zigzag_index[i]] = m.data()[i];
 
     return r;
 };
@@ -56,30 +73,68 @@ std::vector<T> zigzag(matrix<T> m) {
 // takes an 8x8 block and the index and returns the matrix index in zigzag order
 inline int zigzag(int i) {
     assert(i < 64);
-    //static const auto lookup = std::vector<uint>({
-    //    0, 1, 5, 6, 14, 15, 27, 28,
-    //    2, 4, 7, 13, 16, 26, 29, 42,
-    //    3, 8, 12, 17, 25, 30, 41, 43,
-    //    9, 11, 18, 24, 31, 40, 44, 53,
-    //    10, 19, 23, 32, 39, 45, 52, 54,
-    //    20, 22, 33, 38, 46, 51, 55, 60,
-    //    21, 34, 37, 47, 50, 56, 59, 61,
-    //    35, 36, 48, 49, 57, 58, 62, 63
-    //});
-    const auto lookup = std::vector<uint>({
-        0, 1, 1*8, 2*8, // 0 1 2 3
-        1*8+1, 2, 3, 1*8+2, 2*8+1, 3*8, 4*8, // 4 - 10
-        3*8+1, 2*8+2, 1*8+3, 4, 5, 1*8+4, 2*8+3, 3*8+2, 4*8+1, 5*8, 6*8, // 11 - 21
-        5*8+1, 4*8+2, 3*8+3, 2*8+4, 1*8+5, 6, 7, 1*8+6, 2*8+5, 3*8+4, 4*8+3, 5*8+2, 6*8+1, 7*8, 7*8+1, // 22 - 36
-        6*8+2, 5*8+3, 4*8+4, 3*8+5, 2*8+6, 1*8+7, 2*8+7, 3*8+6, 4*8+5, 5*8+4, 6*8+3, 7*8+2, 7*8+3, // 37 - 42 - 49
-        6*8+4, 5*8+5, 4*8+6, 3*8+7, 4*8+7, 5*8+6, 6*8+5, 7*8+4, 7*8+5, // 50 - 53 - 58
-        6*8+6, 5*8+7, 6*8+7, 7*8+6, 7*8+7 // 59 - 60 - 63
-    });
-    assert(lookup.size() == 64);
-
-    return lookup[i];
+    return zigzag_order[i];
 };
 
+// bit i is set if the coefficient at zigzag position i of the 8x8 block is not 0
+// the block is row major with a row stride of stride ints
+inline uint64_t nonzeroMask(const int* block, size_t stride) {
+    uint64_t row_major_mask = 0;
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    const auto zero = _mm_setzero_si128();
+    for (auto row = 0U; row < 8; ++row) {
+        const auto* p = block + row * stride;
+        auto zeros_lo = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) p), zero);
+        auto zeros_hi = _mm_cmpeq_epi32(_mm_loadu_si128((const __m128i*) (p + 4)), zero);
+        auto zeros16 = _mm_packs_epi32(zeros_lo, zeros_hi);
+        auto zeros8 = _mm_packs_epi16(zeros16, zeros16);
+        auto nonzero_bits = ~_mm_movemask_epi8(zeros8) & 0xFF;
+        row_major_mask |= static_cast<uint64_t>(nonzero_bits) << (8 * row);
+    }
+#else
+    for (auto i = 0U; i < 64; ++i) {
+        if (block[(i >> 3) * stride + (i & 7)] != 0)
+            row_major_mask |= 1ULL << i;
+    }
+#endif
+
+    // move the bits to their zigzag positions, only the nonzero coefficients are visited
+    uint64_t mask = 0;
+    while (row_major_mask) {
+        mask |= 1ULL << zigzag_index[countTrailingZeros(row_major_mask)];
+        row_major_mask &= row_major_mask - 1;
+    }
+    return mask;
+}
+
+// walks the AC coefficients of an 8x8 block (row major, row stride in ints) in zigzag order
+// and calls emit(zeros_before, value) for every nonzero value, every 16 zeros (15, 0) and the EOB (0, 0)
+// jumps from one nonzero coefficient to the next, so the cost depends on the number of nonzero values
+template <typename EmitFn>
+inline void runLengthScan(const int* block, size_t stride, EmitFn emit) {
+    auto mask = nonzeroMask(block, stride) & ~1ULL; // DC isn't part of the AC run lengths
+
+    int last = 0;
+    while (mask) {
+        auto pos = countTrailingZeros(mask);
+        auto zero_counter = pos - last - 1;
+        while (zero_counter > 15) {
+            emit(15, 0);
+            zero_counter -= 16;
+        }
+
+        auto idx = zigzag_order[pos];
+        emit(zero_counter, block[(idx >> 3) * stride + (idx & 7)]);
+
+        last = pos;
+        mask &= mask - 1;
+    }
+
+    // EOB
+    if (last != 63)
+        emit(0, 0);
+}
 
 inline matrix<int> quantize(const mat& m, const mat& table) {
     assert(m.size1() == 8);
@@ -143,122 +198,77 @@ inline std::vector<RLE_PAIR> RLE_AC(const std::vector<int> &data) {
     return AC_rle;
 }
 
-// takes an 8x8 quantized DCT block
+// takes an 8x8 quantized DCT block (row major, row stride in ints)
 // and does an RLE on the zigzag sorted values
-inline std::vector<RLE_PAIR> RLE_AC(const matrix<int> &data) {
-    assert(data.size1() == data.size2());
-    assert(data.size1() == 8);
-
+inline std::vector<RLE_PAIR> RLE_AC(const int* block, size_t stride) {
     std::vector<RLE_PAIR> AC_rle;
     // dc part, run length is always 0
-    AC_rle.push_back(RLE_PAIR(0, data(0, 0)));
-
+    AC_rle.push_back(RLE_PAIR(0, block[0]));
 
-    unsigned int zero_counter = 0;
-    for (int i = 1; i < 64; ++i) {
-        auto zigzag_idx = zigzag(i);
-        const auto& value = data.data()[zigzag_idx];
+    runLengthScan(block, stride, [&](int zeros_before, int value) {
+        AC_rle.push_back(RLE_PAIR(zeros_before, value));
+    });
 
-        if (value == 0) {
-            ++zero_counter;
-            continue;
-        }
-        else {
-            if (zero_counter > 15) {
-                do {
-                    AC_rle.push_back(RLE_PAIR(15, 0));
-                    zero_counter -= 16;
-                } while (zero_counter > 15);
-            }
-            AC_rle.push_back(RLE_PAIR(zero_counter, value));
-            zero_counter = 0;
-        }
-    }
+    return AC_rle;
+}
 
-    // EOB
-    if (zero_counter > 0)
-        AC_rle.push_back(RLE_PAIR(0, 0));
+inline std::vector<RLE_PAIR> RLE_AC(const matrix<int> &data) {
+    assert(data.size1() == data.size2());
+    assert(data.size1() == 8);
 
-    return AC_rle;
+    return RLE_AC(&data.data()[0], 8);
 }
 
 struct Category_Code {
-    uint8_t symbol;
-    Bitstream code;
+    uint8_t symbol; // number of zeros before in the high nibble, category in the low nibble
+    uint16_t code;  // amplitude bits, the category is the number of bits
+
+    Category_Code(uint8_t p, uint16_t c) : symbol(p), code(c) {}
+    Category_Code(uint8_t p, Bitstream b)
+        : symbol(p),
+        code(b.size() > 0 ? static_cast<uint16_t>(b.extract(b.size(), 0) >> (32 - b.size())) : 0)
+    {}
 
-    Category_Code(uint8_t p, Bitstream b) : symbol(p), code(b) {}
-    ~Category_Code() {}
+    uint8_t length() const { return symbol & 0x0F; }
 };
 
 inline bool operator==(const Category_Code &left, const Category_Code &right) {
     return (left.symbol == right.symbol) && (left.code == right.code);
 }
 
-inline void getCategoryAndCode(int value, short &_category, Bitstream &_code) {
-    if (value == 0) {
-        _category = 0;
-        _code = Bitstream();
-        return;
-    }
+// category (number of bits needed for the amplitude) of a value, 0 for 0
+inline uint8_t getCategory(int value) {
+    uint32_t abs_val = value < 0 ? -value : value;
+    // the | 1 keeps clz away from 0, the category of 0 is masked out afterwards
+    return static_cast<uint8_t>((32 - countLeadingZeros(abs_val | 1)) & -static_cast<int>(abs_val != 0));
+}
 
-    unsigned short category = 1;
-    auto bound = 2L;
-    while (category < 16) {
-        auto upper_bound = bound - 1;
-        auto lower_bound = (bound >> 1);
-
-        auto abs_val = abs(value);
-        if (abs_val >= lower_bound && abs_val <= upper_bound) {
-            // got category, generate code
-
-            auto offset = 0L;
-            if (value < 0)
-                offset = upper_bound - abs_val;
-            else
-                offset = value;
-
-            _category = category;
-            _code = Bitstream(offset, category);
-            return;
-        }
+struct CategoryBits {
+    uint8_t category;
+    uint16_t bits; // the lowest category bits are used
+};
 
-        bound <<= 1;
-        ++category;
-    }
+// positive values are coded as they are, negative values as value - 1 (one's complement) in category bits
+inline CategoryBits getCategoryAndBits(int value) {
+    assert(value > -32768 && value < 32768);
+
+    CategoryBits result;
+    result.category = getCategory(value);
 
-    assert(!"Shouldn't happen!");
+    auto sign = value >> 31; // 0 or -1
+    result.bits = static_cast<uint16_t>((value + sign) & ((1 << result.category) - 1));
+    return result;
 }
 
-inline std::pair<short, Bitstream> getCategoryAndCode(int value) {
-    if (value == 0)
-        return std::make_pair(0, Bitstream());
-
-    unsigned short category = 1;
-    auto bound = 2l;
-    while (category < 16) {
-        auto upper_bound = bound - 1;
-        auto lower_bound = (bound >> 1);
-        auto bound_diff = upper_bound - lower_bound;
-
-        auto abs_val = abs(value);
-        if (abs_val >= lower_bound && abs_val <= upper_bound) {
-            // got category, generate code
-
-            auto offset = 0l;
-            if (value < 0)
-                offset = upper_bound - abs_val;
-            else
-                offset = value;
-
-            return std::make_pair(category, Bitstream(offset, category));
-        }
-        
-        bound <<= 1;
-        ++category;
-    }
+inline void getCategoryAndCode(int value, short &_category, Bitstream &_code) {
+    auto category_bits = getCategoryAndBits(value);
+    _category = category_bits.category;
+    _code = Bitstream(category_bits.bits, category_bits.category);
+}
 
-    assert(!"Shouldn't happen!");
-    return std::make_pair(0, Bitstream());
+inline std::pair<short, Bitstream> getCategoryAndCode(int value) {
+    auto category_bits = getCategoryAndBits(value);
+    return std::make_pair(static_cast<short>(category_bits.category), Bitstream(category_bits.bits, category_bits.category));
 }
 
 // takes the encoded list of RLE_PAIRS and generates the symbol for huffman coding and a code from category encoding 
@@ -267,17 +277,62 @@ inline std::vector<Category_Code> encode_category(const std::vector<RLE_PAIR> &d
     category_list.reserve(data.size());
 
     for (const auto& rle_pair : data) {
-        short category = 0;
-        Bitstream code;
-        getCategoryAndCode(rle_pair.value, category, code);
+        auto category_bits = getCategoryAndBits(rle_pair.value);
 
         assert(rle_pair.num_zeros_before < 16);
-        assert(category < 16);
+        assert(category_bits.category < 16);
         // rle_pair.num_zeros_before == 0 for the DC value
-        auto symbol = (rle_pair.num_zeros_before << 4) | category;
+        auto symbol = (rle_pair.num_zeros_before << 4) | category_bits.category;
 
-        category_list.emplace_back(symbol, code);
+        category_list.emplace_back(symbol, category_bits.bits);
     }
 
     return category_list;
-}
\ No newline at end of file
+}
+
+// DC difference, RLE and category coding of one quantized block without intermediate symbol lists.
+// calls emit_dc(symbol, category_bits) once and emit_ac(symbol, category_bits) for every AC symbol.
+// previous_dc is the DC value of the last block of the same component and gets updated for the next one
+template <typename DcFn, typename AcFn>
+inline void scanBlockSymbols(const int* block, size_t stride, int& previous_dc, DcFn emit_dc, AcFn emit_ac) {
+    auto dc = getCategoryAndBits(block[0] - previous_dc);
+    previous_dc = block[0];
+    emit_dc(dc.category, dc);
+
+    runLengthScan(block, stride, [&](int zeros_before, int value) {
+        auto ac = getCategoryAndBits(value);
+        emit_ac(static_cast<uint8_t>((zeros_before << 4) | ac.category), ac);
+    });
+}
+
+// the number of bits encodeBlock writes for the block, without writing them
+inline uint32_t blockBits(const int* block, size_t stride, int& previous_dc, const CodeTable& dc_table, const CodeTable& ac_table) {
+    uint32_t bits = 0;
+    scanBlockSymbols(block, stride, previous_dc,
+        [&](uint8_t symbol, CategoryBits category_bits) { bits += dc_table.length(symbol) + category_bits.category; },
+        [&](uint8_t symbol, CategoryBits category_bits) { bits += ac_table.length(symbol) + category_bits.category; });
+    return bits;
+}
+
+// same for the category codes of a block (DC first, like encode_category makes them)
+inline uint32_t blockBits(const std::vector<Category_Code>& codes, const CodeTable& dc_table, const CodeTable& ac_table) {
+    uint32_t bits = 0;
+    for (auto it = begin(codes); it != end(codes); ++it)
+        bits += (it == begin(codes) ? dc_table : ac_table).length(it->symbol) + it->length();
+    return bits;
+}
+
+// RLE, category and huffman coding of one quantized block straight into the output
+template <typename Writer>
+inline void encodeBlock(const int* block, size_t stride, int& previous_dc,
+                        const CodeTable& dc_table, const CodeTable& ac_table, Writer& writer) {
+    auto write = [&writer](const CodeTable& table, uint8_t symbol, CategoryBits category_bits) {
+        assert(table.length(symbol) > 0);
+        writer.push_back_LSB_mode(table.code(symbol), table.length(symbol));
+        writer.push_back_LSB_mode(category_bits.bits, category_bits.category);
+    };
+
+    scanBlockSymbols(block, stride, previous_dc,
+        [&](uint8_t symbol, CategoryBits category_bits) { write(dc_table, symbol, category_bits); },
+        [&](uint8_t symbol, CategoryBits category_bits) { write(ac_table, symbol, category_bits); });
+}
@@ -44,20 +44,19 @@ const PixelDataType s7 = 1 / (4 * c7);
 
 
 
-inline void dctArai(const matrix_range<matrix<PixelDataType>>& x, matrix_range<matrix<PixelDataType>>& y) {
-    assert(x.size1() == 8 && x.size2() == 8);
-
-    matrix<PixelDataType> temp_mat(8, 8);
+// 8x8 block at x (row stride x_stride) to y (row stride y_stride), the temporary block stays on the stack
+inline void dctArai(const PixelDataType* x, size_t x_stride, PixelDataType* y, size_t y_stride) {
+    PixelDataType temp_mat[8][8];
 
     for (uint j = 0; j < 8; j++) {
-        auto x0 = x(0, j);
-        auto x1 = x(1, j);
-        auto x2 = x(2, j);
-        auto x3 = x(3, j);
-        auto x4 = x(4, j);
-        auto x5 = x(5, j);
-        auto x6 = x(6, j);
-        auto x7 = x(7, j);
+        auto x0 = x[j];
+        auto x1 = x[1 * x_stride + j];
+        auto x2 = x[2 * x_stride + j];
+        auto x3 = x[3 * x_stride + j];
+        auto x4 = x[4 * x_stride + j];
+        auto x5 = x[5 * x_stride + j];
+        auto x6 = x[6 * x_stride + j];
+        auto x7 = x[7 * x_stride + j];
 
         auto z0 = x0 + x7;
         auto z1 = x1 + x6;
@@ -121,25 +120,25 @@ inline void dctArai(const matrix_range<matrix<PixelDataType>>& x, matrix_range<m
         auto w7 = v7 - v4;
 
         // also transposes
-        temp_mat(j, 0) = w0 * s0;
-        temp_mat(j, 4) = w1 * s4;
-        temp_mat(j, 2) = w2 * s2;
-        temp_mat(j, 6) = w3 * s6;
-        temp_mat(j, 5) = w4 * s5;
-        temp_mat(j, 1) = w5 * s1;
-        temp_mat(j, 7) = w6 * s7;
-        temp_mat(j, 3) = w7 * s3;
+        temp_mat[j][0] = w0 * s0;
+        temp_mat[j][4] = w1 * s4;
+        temp_mat[j][2] = w2 * s2;
+        temp_mat[j][6] = w3 * s6;
+        temp_mat[j][5] = w4 * s5;
+        temp_mat[j][1] = w5 * s1;
+        temp_mat[j][7] = w6 * s7;
+        temp_mat[j][3] = w7 * s3;
     }
 
     for (uint j = 0; j < 8; j++) {
-        auto x0 = temp_mat(0, j);
-        auto x1 = temp_mat(1, j);
-        auto x2 = temp_mat(2, j);
-        auto x3 = temp_mat(3, j);
-        auto x4 = temp_mat(4, j);
-        auto x5 = temp_mat(5, j);
-        auto x6 = temp_mat(6, j);
-        auto x7 = temp_mat(7, j);
+        auto x0 = temp_mat[0][j];
+        auto x1 = temp_mat[1][j];
+        auto x2 = temp_mat[2][j];
+        auto x3 = temp_mat[3][j];
+        auto x4 = temp_mat[4][j];
+        auto x5 = temp_mat[5][j];
+        auto x6 = temp_mat[6][j];
+        auto x7 = temp_mat[7][j];
 
         auto z0 = x0 + x7;
         auto z1 = x1 + x6;
@@ -203,17 +202,22 @@ inline void dctArai(const matrix_range<matrix<PixelDataType>>& x, matrix_range<m
         auto w7 = v7 - v4;
 
         // also transposes
-        y(j, 0) = w0 * s0;
-        y(j, 4) = w1 * s4;
-        y(j, 2) = w2 * s2;
-        y(j, 6) = w3 * s6;
-        y(j, 5) = w4 * s5;
-        y(j, 1) = w5 * s1;
-        y(j, 7) = w6 * s7;
-        y(j, 3) = w7 * s3;
+        y[j * y_stride + 0] = w0 * s0;
+        y[j * y_stride + 4] = w1 * s4;
+        y[j * y_stride + 2] = w2 * s2;
+        y[j * y_stride + 6] = w3 * s6;
+        y[j * y_stride + 5] = w4 * s5;
+        y[j * y_stride + 1] = w5 * s1;
+        y[j * y_stride + 7] = w6 * s7;
+        y[j * y_stride + 3] = w7 * s3;
     }
 }
 
+inline void dctArai(const matrix_range<matrix<PixelDataType>>& x, matrix_range<matrix<PixelDataType>>& y) {
+    assert(x.size1() == 8 && x.size2() == 8);
+    dctArai(&x(0, 0), x.data().size2(), &y(0, 0), y.data().size2());
+}
+
 
 const auto blocksize = 8U;
 // Matrix A
@@ -0,0 +1,204 @@
+#pragma once
+
+#include <array>
+#include <vector>
+
+#include "Image.hpp"
+#include "JpegSegments.hpp"
+
+// 8 bit quantization table in row major order
+typedef std::array<Byte, 64> QuantizationTable;
+
+// the tables from Annex K
+const QuantizationTable& standardLuminanceTable();
+const QuantizationTable& standardChrominanceTable();
+
+// scaled like in the IJG libjpeg: quality 50 is the table itself, 100 all ones and lower qualities are coarser
+// (quality 1 to 100, the entries stay from 1 to 255 for the 8 bit DQT segments)
+QuantizationTable scaleQuantizationTable(const QuantizationTable& table, int quality);
+
+// everything that decides how an image is encoded, the defaults are what writeJPEG always did.
+// the output goes to the OutputSink passed along with the options
+struct EncoderOptions {
+    EncoderOptions();
+
+    // layout and filter of the chroma: S444 has MCUs of 8x8 pixels, S422 16x8, S411 32x8 and the three
+    // S420 modes 16x16 (point samples, 2x2 means or vertical means). subsampled YUV input needs its own layout
+    Image::SubsamplingMode subsampling;
+    Image::DCTMode dct_mode;            // Simple and Matrix are the slow reference kernels
+    QuantizationTable quantization_y, quantization_c;
+    int quality;                        // 1 to 100, scales both tables with scaleQuantizationTable (50 keeps them)
+    // rate control: with a target_size (in bytes, 0 for none) the highest quality up to quality is used whose
+    // jpeg isn't bigger. if not even quality 1 fits, that's what is written
+    size_t target_size;
+
+    Image::HuffmanMode huffman_mode;
+    const TableProfile* table_profile;  // for Profile
+    uint restart_interval;              // MCUs between two restart markers (at most 65535), 0 for none
+    bool interleaved;
+    const ScanScript* scan_script;      // progressive with a script, see Image::writeJPEG
+
+    int threads;                        // OpenMP threads for the encode, 0 keeps the current setting
+};
+
+// throws std::invalid_argument for options the image can't be encoded with: a broken scan script, zeros in a
+// quantization table, a quality out of 1 to 100, a restart interval over 65535, the Profile mode without a profile
+// or subsampled input in another layout
+void checkEncoderOptions(const Image& image, const EncoderOptions& options);
+
+// upper bound for the size of the jpeg file of an image of that size with these options (any HuffmanMode, subsampling
+// and restart interval, baseline or with the scan script)
+size_t maxEncodedSize(uint width, uint height, const EncoderOptions& options);
+
+// samples or coefficients of one component in row major order. the storage only grows, so a smaller plane reuses it
+template <typename T>
+class Plane {
+public:
+    Plane() : width(0), height(0) {}
+
+    void resize(uint w, uint h) {
+        width = w;
+        height = h;
+        values.resize(static_cast<size_t>(w) * h);
+    }
+    void reserve(size_t count) { values.reserve(count); }
+
+    T& operator()(uint row, uint column) { return values[static_cast<size_t>(row) * width + column]; }
+    const T& operator()(uint row, uint column) const { return values[static_cast<size_t>(row) * width + column]; }
+
+    const T* data() const { return values.data(); }
+    size_t stride() const { return width; }
+
+    uint width, height;
+
+private:
+    std::vector<T> values;
+};
+
+// everything writeJPEG needs besides the image: coefficient planes, scan buffers, quantization and huffman tables.
+// one Encoder can write any number of images one after another. its buffers grow to the largest image so far and
+// are reused, so baseline images of that size or smaller are encoded without a single allocation (at a quality used
+// before and with the Arai DCT), the huffman tables of the Optimized and Sampled modes are built in kept storage too.
+// progressive scans still allocate their tables.
+// an Encoder isn't thread safe (its loops use OpenMP), every thread needs its own
+class Encoder {
+public:
+    Encoder();
+    Encoder(uint max_width, uint max_height); // with buffers for images up to that size
+
+    void reserve(uint max_width, uint max_height);
+
+    // the image isn't changed. invalid options (see checkEncoderOptions) throw std::invalid_argument before
+    // anything is written
+    void encode(const Image& image, OutputSink& sink, const EncoderOptions& options = EncoderOptions());
+
+    // counts the huffman symbols of all blocks of the image (for trainTableProfile), transformed and quantized
+    // with the options
+    SymbolStatistics collectStatistics(const Image& image, const EncoderOptions& options = EncoderOptions());
+
+    // the quality of the last image (the one rate control picked)
+    int lastQuality() const { return last_quality; }
+
+    // HELPER
+private:
+    // color conversion, chroma subsampling and DCT of whole MCUs into DctY, DctCb and DctCr
+    void transform(const Image& image, Image::SubsamplingMode subsampling, Image::DCTMode dct_mode);
+    void quantize(uint mcu_row_step = 1);  // DctY, DctCb and DctCr into QY, QCb and QCr (every mcu_row_step-th MCU row)
+    // selects the tables of that quality, they are built once and kept. other base tables start a new cache
+    void useQuality(const QuantizationTable& table_y, const QuantizationTable& table_c, int quality);
+    // the size of Y, Cb and Cr without the padding to whole MCUs
+    void componentSizes(uint widths[3], uint heights[3]) const;
+
+    // fills the symbol histograms from every mcu_row_step-th MCU row of the quantized blocks.
+    // with a restart_interval (in MCUs) the DC predictions start at 0 after every restart marker like in encodeScan
+    void collectSampledStatistics(uint mcu_row_step, uint restart_interval);
+    // non-interleaved scans: statistics of the blocks of every component on its own
+    void collectComponentStatistics(uint restart_interval);
+
+    void encodeMCUs(uint first_mcu, uint end_mcu, // MCUs in raster order, DC prediction starts at 0 by default
+                    const CodeTable &Y_DC,
+                    const CodeTable &Y_AC,
+                    const CodeTable &C_DC,
+                    const CodeTable &C_AC,
+                    BitWriter& stream,
+                    bool continue_prediction = false) const;  // the DC predictions start from the MCU before first_mcu
+    // single pass coding of the quantized blocks in MCU order into the scan parts.
+    // with a restart_interval > 0 every part is one interval (coded in parallel), an RSTn marker goes between them
+    void encodeScan(const CodeTable &Y_DC,
+                    const CodeTable &Y_AC,
+                    const CodeTable &C_DC,
+                    const CodeTable &C_AC,
+                    uint restart_interval);
+    // the same bits as encodeScan without restart markers, the MCU rows are coded in parallel and put together at their bit offsets
+    void encodeScanParallel(const CodeTable &Y_DC,
+                            const CodeTable &Y_AC,
+                            const CodeTable &C_DC,
+                            const CodeTable &C_AC);
+    // non-interleaved scans: one scan part per component, coded in parallel
+    void encodeComponentScans(const CodeTable &Y_DC,
+                              const CodeTable &Y_AC,
+                              const CodeTable &C_DC,
+                              const CodeTable &C_AC,
+                              uint restart_interval);
+    void useScanParts(uint count);
+
+    // rate control: the DCT is done once, every quality only quantizes and counts symbols again
+    void encodeWithinSize(OutputSink& sink, const EncoderOptions& options);
+    int chooseQuality(const EncoderOptions& options, size_t target_size, int highest_quality);
+    size_t estimateSize(const EncoderOptions& options, int quality); // of the baseline jpeg from the symbol counts
+
+    void writeImage(OutputSink& sink, const EncoderOptions& options); // SOI up to EOI of the quantized blocks
+    void writeHeaders(OutputSink& sink, bool progressive); // SOI up to SOF
+    void useProfile(const TableProfile& table_profile);   // profile_codes and table_header for the profile
+    void writeBaseline(OutputSink& sink, Image::HuffmanMode huffman_mode, const TableProfile* table_profile, uint restart_interval, bool interleaved);
+    void writeProgressive(OutputSink& sink, const ScanScript& scan_script);
+
+    // HIDDEN MEMBERS
+private:
+    uint real_width, real_height;
+    uint luma_h, luma_v; // Y blocks per MCU horizontally and vertically (the sampling factors of Y), one Cb and one Cr block
+    uint mcus_x, mcus_y;
+
+    Plane<PixelDataType> DctY, DctCb, DctCr;
+    Plane<int> QY, QCb, QCr;
+
+    // the scaled tables of one quality, their reciprocals and the SOI, APP0 and DQT segments
+    struct QuantizationSet {
+        int quality;
+        QuantizationTable table_y, table_c;
+        PixelDataType reciprocal_y[64], reciprocal_c[64];
+        MemorySink header;
+    };
+    QuantizationTable base_y, base_c; // the tables the cached sets are scaled from
+    std::vector<QuantizationSet> quantization_sets;
+    size_t quantization_set;          // the one in use
+
+    SymbolHistogram HistogramY_DC, HistogramY_AC, HistogramC_DC, HistogramC_AC;
+
+    // the tables of the last profile, they are generated again only for a different one
+    SymbolsPerLength profile_tables[4];
+    CodeTable profile_codes[4];
+
+    // the tables built for every image (Optimized, Sampled, rate control estimates), their DHT segments and
+    // the storage they are built in
+    HuffmanScratch huffman_scratch;
+    SymbolsPerLength generated_tables[4];
+    CodeTable generated_codes[4];
+    Segment::sDHT generated_segments[4];
+
+    // entropy coded data, only the first scan_part_count are in use
+    std::vector<BitWriter> scan_parts;
+    uint scan_part_count;
+    // encodeScanParallel: unstuffed MCU rows, their bit offsets and the rows put together
+    std::vector<BitWriter> row_streams;
+    std::vector<size_t> row_offsets;
+    std::vector<uint8_t> joined_rows;
+
+    // the segments with vectors inside are written once: the DHT segments of the fixed tables (again if they change)
+    MemorySink table_header;
+    Image::HuffmanMode table_header_mode;
+
+    // rate control writes here first, the jpeg goes to the sink once it fits
+    MemorySink sized_output;
+    int last_quality;
+};
@@ -1,19 +1,20 @@
 #pragma once
 
 #include "BitstreamGeneric.hpp"
+#include "BitReader.hpp"
 
 #include <vector>
+#include <array>
+#include <algorithm>
 #include <memory>
 #include <unordered_map>
 #include <numeric>
-#include <queue>
 #include <iostream>
 #include <assert.h>
 #include <iterator>
 #include <utility>
 
 using std::unordered_map;
-using std::priority_queue;
 using std::vector;
 using std::pair;
 
@@ -48,30 +49,112 @@ struct Code {
 using SymbolCodeMap = std::unordered_map<int, Code>;
 using SymbolsPerLength = vector<vector<int>>;
 
+// number of occurrences of every byte symbol (jpeg huffman symbols are bytes)
+struct SymbolHistogram : std::array<uint32_t, 256> {
+    SymbolHistogram() { fill(0); }
+
+    SymbolHistogram& operator+=(const SymbolHistogram& other) {
+        for (auto i = 0U; i < size(); ++i)
+            (*this)[i] += other[i];
+        return *this;
+    }
+};
+
+
+// dense code table for byte symbols, every entry is one word:
+// the right aligned code in the upper 24 bits and the code length in the lowest byte (0: symbol has no code)
+struct CodeTable {
+    std::array<uint32_t, 256> packed;
+
+    CodeTable() { packed.fill(0); }
+
+    void set(uint8_t symbol, uint32_t code, uint8_t length) {
+        assert(length <= 24);
+        packed[symbol] = (code << 8) | length;
+    }
+
+    uint32_t code(uint8_t symbol) const { return packed[symbol] >> 8; }
+    uint8_t length(uint8_t symbol) const { return packed[symbol] & 0xFF; }
+};
+
 
 // takes a text, caluclates the probability of every symbol and returns a map from symbols to huffman codes
 pair<SymbolCodeMap, SymbolsPerLength> generateHuffmanCode(std::vector<int> text);
+// same, but with already counted byte symbols. Symbols that don't occur don't get a code
+pair<CodeTable, SymbolsPerLength> generateHuffmanCode(const SymbolHistogram& histogram);
+
+// size of the coded symbols without coding them: the code length of every counted symbol plus its category bits
+// (the low nibble of DC and AC symbols). exact besides byte stuffing and the padding at the end
+uint64_t encodedBits(const SymbolHistogram& histogram, const CodeTable& table);
+
+// give every symbol a DC (categories 0..11) or AC table (EOB, ZRL, run/category 1..10) can be asked for
+// at least a count of one, so tables built from the statistics of a part of an image can code all of it
+void reserveDCSymbols(SymbolHistogram& histogram);
+void reserveACSymbols(SymbolHistogram& histogram);
 
 void preventOnlyOnesCode(SymbolsPerLength& symbols);
 SymbolCodeMap generateCodes(const SymbolsPerLength& symbols);
+CodeTable generateCodeTable(const SymbolsPerLength& symbols);
+
+// the typical huffman tables from ITU-T T.81 Annex K.3, they don't depend on the image,
+// so an encoder using them doesn't need the symbol statistics before it can start writing
+enum class StandardTable {
+    LuminanceDC,
+    LuminanceAC,
+    ChrominanceDC,
+    ChrominanceAC
+};
+
+const SymbolsPerLength& standardSymbolsPerLength(StandardTable table);
+const CodeTable& standardCodeTable(StandardTable table);
 
 
 
 // en- and decoding
-Bitstream huffmanEncode(vector<int> text, SymbolCodeMap code_map);
-vector<int> huffmanDecode(Bitstream bitstream, SymbolCodeMap code_map);
+Bitstream huffmanEncode(const vector<int>& text, const SymbolCodeMap& code_map);
+Bitstream huffmanEncode(const vector<uint8_t>& text, const CodeTable& code_table);
+vector<int> huffmanDecode(const Bitstream& bitstream, const SymbolsPerLength& symbols);
+// code_map must hold canonical codes like the ones from generateCodes
+vector<int> huffmanDecode(const Bitstream& bitstream, const SymbolCodeMap& code_map);
+
+// canonical huffman decoder: codes up to lookahead_bits long are decoded with one table lookup,
+// longer ones by comparing against the largest code of every length
+class HuffmanDecoder {
+public:
+    static const int lookahead_bits = 9;
+
+    struct Entry {
+        int symbol;
+        uint8_t length; // 0: invalid code
+    };
 
-struct DecodeEntry {
-    DecodeEntry(uint32_t code, uint8_t code_length, int symbol);
+    explicit HuffmanDecoder(const SymbolsPerLength& symbols);
 
-    // code starting at msb, rest filled with 1s
-    uint32_t code;
-    uint8_t code_length;
-    int symbol;
+    // bits are the next 16 bits of the stream with the first one as bit 15, missing bits at the end should be 1s
+    Entry decode(uint32_t bits) const {
+        assert(bits < (1 << 16));
+        auto& entry = lookup[bits >> (16 - lookahead_bits)];
+        if (entry.length > 0)
+            return entry;
+        return decodeLong(bits);
+    }
 
-    bool operator<(const DecodeEntry& other) {
-        return code < other.code;
+    // decodes the next symbol and consumes its code, -1 for an invalid code
+    int decode(BitReader& reader) const {
+        auto entry = decode(reader.peek(16));
+        if (entry.length == 0)
+            return -1;
+        reader.skip(entry.length);
+        return entry.symbol;
     }
+
+private:
+    Entry decodeLong(uint32_t bits) const;
+
+    std::array<Entry, 1 << lookahead_bits> lookup;
+    int max_code[17];       // largest code of every length, -1 if there is none
+    int value_offset[17];   // code + value_offset[length] is the index into values
+    vector<int> values;     // symbols in code order
 };
 
 struct Symbol {
@@ -108,67 +191,117 @@ struct Package {
     }
 };
 
-// input: list of symbols (with its frequency)
-//        maximum code length
-// output: a code length for each symbol
-inline SymbolsPerLength package_merge(vector<Symbol> symbols, int length_limit) {
-    assert(symbols.size() <= pow(2, length_limit));
+// the vectors package_merge and generateHuffmanCode work in. an encoder that keeps one (and its SymbolsPerLength)
+// builds its tables without allocating once they have grown to the largest alphabet
+struct HuffmanScratch {
+    vector<Symbol> symbols;
+    vector<uint8_t> is_package;
+    vector<size_t> level_size;
+    vector<uint64_t> weights, next_weights;
+    vector<int> code_lengths;
+};
 
-    auto comp = [](const Package& lhs, const Package& rhs) {
-        return lhs.weight > rhs.weight;
-    };
-    using Level = priority_queue<Package, vector<Package>, decltype(comp)>;
-
-    // blueprint level
-    Level level;
-    for (const auto& sym : symbols)
-        level.push(sym);
-
-    // allocate number of levels 2^-1 up to 2^-length_limit
-    // levels[0] should be 2^-length_limit and levels[length_limit] should be 2^0
-    vector<Level> levels;
-    levels.reserve(length_limit);
-    for (auto i = 0; i < length_limit; ++i)
-        levels.push_back(level);
-    levels.push_back(Level()); // last list is empty (level 2^0 or 1)
-
-    for (auto i = 0; i < length_limit; ++i) {
-        auto& level = levels[i];
-        auto& next_level = levels[i + 1];
-
-        // package the least 2 packages if there are more than 2
-        while (level.size() > 1) {
-            auto p1 = level.top();
-            level.pop();
-            auto p2 = level.top();
-            level.pop();
-
-            // package & merge
-            next_level.push(Package{ p1, p2 });
+// input: list of symbols (with its frequency), sorted here
+//        maximum code length
+// output: the symbols of every code length (length_limit + 2 lists, symbolsByCodeLength[0] stays empty)
+//
+// packages aren't built explicitly: every level only stores its item weights and which items are packages.
+// a level is the merge of the sorted symbols and the packages (pairs) of the level below, so the symbols
+// taken from a level are always the cheapest ones and counting them is enough to get the code lengths
+inline void package_merge(vector<Symbol>& symbols, int length_limit, HuffmanScratch& scratch, SymbolsPerLength& symbolsByCodeLength) {
+    const auto n = symbols.size();
+    assert(length_limit > 0 && length_limit < 32);
+    assert(n <= (size_t(1) << length_limit));
+
+    // sort by frequency, equal frequencies by symbol to get deterministic codes
+    std::sort(begin(symbols), end(symbols), [](const Symbol& lhs, const Symbol& rhs) {
+        return lhs.frequency < rhs.frequency || (lhs.frequency == rhs.frequency && lhs.symbol < rhs.symbol);
+    });
+
+    // levels[0] is 2^-length_limit, levels[length_limit - 1] is 2^-1
+    // a level has at most 2n - 1 items (n symbols + n - 1 packages)
+    const auto max_items = 2 * n;
+    auto& is_package = scratch.is_package;
+    auto& level_size = scratch.level_size;
+    auto& weights = scratch.weights;
+    auto& next_weights = scratch.next_weights;
+    is_package.assign(length_limit * max_items, 0);
+    level_size.assign(length_limit, 0);
+    weights.resize(max_items);
+    next_weights.resize(max_items);
+
+    for (auto i = 0U; i < n; ++i)
+        weights[i] = static_cast<uint64_t>(symbols[i].frequency);
+    level_size[0] = n;
+
+    for (auto level = 1; level < length_limit; ++level) {
+        const auto num_packages = level_size[level - 1] / 2;
+        auto* package_flags = &is_package[level * max_items];
+
+        // merge symbols and packages of the level below (the packages are sorted as well)
+        size_t sym = 0, pkg = 0, out = 0;
+        while (sym < n || pkg < num_packages) {
+            const uint64_t package_weight = pkg < num_packages ? weights[2 * pkg] + weights[2 * pkg + 1] : 0;
+            const uint64_t symbol_weight = sym < n ? static_cast<uint64_t>(symbols[sym].frequency) : 0;
+
+            if (pkg >= num_packages || (sym < n && symbol_weight <= package_weight)) {
+                next_weights[out++] = symbol_weight;
+                ++sym;
+            }
+            else {
+                package_flags[out] = 1;
+                next_weights[out++] = package_weight;
+                ++pkg;
+            }
         }
+
+        level_size[level] = out;
+        std::swap(weights, next_weights);
     }
 
-    // count the occurences of the symbols in the remaining packages
-    // the count is the code length for that symbol
-    unordered_map<int, int> code_lengths;
-    auto& final_level = levels[length_limit];
-    while (final_level.size()) {
-        const auto package = final_level.top();
-        final_level.pop();
+    // the final level 2^0 holds the packages of the items of level 2^-1
+    // going down, every package that is used needs both items of the level below
+    auto& code_lengths = scratch.code_lengths;
+    code_lengths.assign(n, 0);
+    auto used_items = 2 * (level_size[length_limit - 1] / 2);
+    for (auto level = length_limit - 1; level >= 0; --level) {
+        const auto* package_flags = &is_package[level * max_items];
+
+        size_t used_symbols = 0, used_packages = 0;
+        for (auto i = 0U; i < used_items; ++i) {
+            if (package_flags[i])
+                ++used_packages;
+            else
+                ++used_symbols;
+        }
+
+        // the used symbols of a level are the cheapest ones
+        for (auto i = 0U; i < used_symbols; ++i)
+            ++code_lengths[i];
 
-        for (const auto& sym : package.symbols)
-            code_lengths[sym.symbol]++;
+        used_items = 2 * used_packages;
     }
 
     // put it in a vector for easy usage
     // +2 to allow for easy insertion of the 111..1 code one level deeper
     // (guess we should refactor that stupid data structure)
-    SymbolsPerLength symbolsByCodeLength(length_limit+2); 
-    for (auto it = code_lengths.begin(); it != code_lengths.end(); ++it){
-        // second: code length
-        // first: symbol
-        symbolsByCodeLength[it->second].push_back(it->first);
-    }
+    symbolsByCodeLength.resize(length_limit + 2);
+    for (auto& symbol_list : symbolsByCodeLength)
+        symbol_list.clear();
+    for (auto i = 0U; i < n; ++i)
+        symbolsByCodeLength[code_lengths[i]].push_back(symbols[i].symbol);
+
+    // symbols of the same code length are ordered by value
+    for (auto& symbol_list : symbolsByCodeLength)
+        std::sort(begin(symbol_list), end(symbol_list));
+}
 
+inline SymbolsPerLength package_merge(vector<Symbol> symbols, int length_limit) {
+    HuffmanScratch scratch;
+    SymbolsPerLength symbolsByCodeLength;
+    package_merge(symbols, length_limit, scratch, symbolsByCodeLength);
     return symbolsByCodeLength;
-}
\ No newline at end of file
+}
+
+// generateHuffmanCode for byte symbols in the storage of the caller: code_table and symbols are overwritten
+void generateHuffmanCode(const SymbolHistogram& histogram, HuffmanScratch& scratch, CodeTable& code_table, SymbolsPerLength& symbols);
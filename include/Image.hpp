@@ -15,6 +15,10 @@
 
 #include "Coding.hpp"
 #include "Huffman.hpp"
+#include "BitWriter.hpp"
+#include "TableProfile.hpp"
+#include "OutputSink.hpp"
+#include "Progressive.hpp"
 
 typedef unsigned int uint;
 typedef uint8_t Byte;
@@ -23,6 +27,7 @@ typedef double PixelDataType;
 using boost::numeric::ublas::matrix;
 
 class Image;
+struct EncoderOptions; // Encoder.hpp
 
 // load a ppm file (P3 or P6 version)
 Image loadPPM(std::string path);
@@ -30,6 +35,36 @@ Image loadPPM(std::string path);
 // fast version of atoi. No error checking, nothing.
 int fast_atoi(const char * str);
 
+// load 8 bit full range YUV frames (e.g. from video decoders or cameras) with arbitrary strides in bytes
+// the image is already in YCbCr with 4:2:0 subsampled chroma, so color conversion and subsampling are skipped
+Image loadI420(const Byte* y, uint y_stride, const Byte* u, uint u_stride, const Byte* v, uint v_stride, uint width, uint height);
+Image loadNV12(const Byte* y, uint y_stride, const Byte* uv, uint uv_stride, uint width, uint height); // interleaved UV plane
+Image loadYUYV(const Byte* yuyv, uint stride, uint width, uint height); // packed 4:2:2, chroma rows are averaged to 4:2:0
+
+// one pixel from RGB to YCbCr (all three shifted by -128 for the DCT)
+inline void convertPixelToYCbCr(PixelDataType r, PixelDataType g, PixelDataType b, PixelDataType& y, PixelDataType& cb, PixelDataType& cr)
+{
+    // matrix factors
+    /*
+      0.299  0.587  0.114
+     -0.169 -0.331  0.500
+      0.500 -0.419 -0.081
+     */
+    static const float Flat[] { .0f, 256/2.f, 256/2.f };
+    static const float Yv[] {  .299f,   .587f,   .114f };
+    static const float Cb[] { -.1687f, -.3312f,  .5f };
+    static const float Cr[] {  .5f,    -.4186f, -.0813f };
+
+    y  = Flat[0] + (Yv[0] * r + Yv[1] * g + Yv[2] * b) - 128;
+    cb = Flat[1] + (Cb[0] * r + Cb[1] * g + Cb[2] * b) - 128;
+    cr = Flat[2] + (Cr[0] * r + Cr[1] * g + Cr[2] * b) - 128;
+}
+
+// upper bound for the size of the jpeg file writeJPEG produces for an image of that size (in any HuffmanMode, with the
+// default 4:2:0 subsampling, see Encoder.hpp for other options),
+// e.g. for the buffer of a FixedBufferSink
+size_t maxEncodedSize(uint width, uint height);
+
 // image class handling three matrix<PixelDataType>s (RGB, YUV, whatever) with one byte pixels
 class Image
 {
@@ -58,6 +93,14 @@ public:
         Arai
     };
 
+    enum HuffmanMode
+    {
+        Optimized,  // tables built from the statistics of the whole image (two passes)
+        Standard,   // typical tables from Annex K, blocks are coded in one pass right after quantization
+        Sampled,    // tables from the statistics of every 4th MCU row, then one pass like Standard
+        Profile     // trained tables loaded with loadTableProfile, one pass like Standard
+    };
+
     // INTERFACE
 public:
     // CTORS
@@ -77,19 +120,38 @@ public:
 
     // apply subsampling to the color matrix<PixelDataType>s (Cb, Cr)
     void applySubsampling(SubsamplingMode mode);
+    bool isSubsampled() const { return subsample_width != width || subsample_height != height; }
+    ColorSpace colorSpace() const { return color_space_type; }
 
+    // the stepwise pipeline from the DCT up to the bitstreams. it is legacy: writeJPEG and everything else that
+    // encodes goes through the Encoder (Encoder.hpp), these steps are only kept to look at the stages one by one
     void applyDCT(DCTMode mode);
     void applyQuantization(const matrix<Byte>& q_table_y, const matrix<Byte>& q_table_c);
     void applyDCdifferenceCoding();
     void doZigZagSorting();
     void doRLEandCategoryCoding();
-    void doHuffmanEncoding(SymbolCodeMap &Y_DC,
-                           SymbolCodeMap &Y_AC,
-                           SymbolCodeMap &C_DC,
-                           SymbolCodeMap &C_AC);
+    void doHuffmanEncoding(const CodeTable &Y_DC,
+                           const CodeTable &Y_AC,
+                           const CodeTable &C_DC,
+                           const CodeTable &C_AC);
+
+    // converts and quantizes the image like writeJPEG and counts the huffman symbols of all blocks (for trainTableProfile)
+    SymbolStatistics collectStatistics() const;
 
     // JPEG SEGMENTS
-    void writeJPEG(std::string file);
+    // the Profile mode needs a table_profile. restart_interval is the number of MCUs (16x16 pixels) between two
+    // restart markers (at most 65535), 0 for none. the intervals are entropy coded in parallel.
+    // without interleaving Y, Cb and Cr are written as three scans one after another, coded in parallel
+    // (their MCUs are single blocks, so restart_interval counts blocks then).
+    // with a scan_script a progressive jpeg is written, every scan has its own optimized tables then and
+    // huffman_mode, restart_interval and interleaved don't apply
+    // the image isn't changed. every call sets up a new Encoder, to encode many images keep one around instead
+    void writeJPEG(std::string file, HuffmanMode huffman_mode = Optimized, const TableProfile* table_profile = nullptr, uint restart_interval = 0, bool interleaved = true, const ScanScript* scan_script = nullptr) const;
+    void writeJPEG(OutputSink& sink, HuffmanMode huffman_mode = Optimized, const TableProfile* table_profile = nullptr, uint restart_interval = 0, bool interleaved = true, const ScanScript* scan_script = nullptr) const;
+    // all settings (subsampling, DCT, quantization tables, threads, ...) in one EncoderOptions, the parameters
+    // above are a shorthand for its huffman and scan settings
+    void writeJPEG(std::string file, const EncoderOptions& options) const;
+    void writeJPEG(OutputSink& sink, const EncoderOptions& options) const;
 
     // HELPER
 private:
@@ -7,6 +7,7 @@
 //
 // JPEG stuff
 //
+// the segments can be written to a std::ostream or an OutputSink, both only need write(const char*, size)
 namespace Segment
 {
     using std::vector;
@@ -62,7 +63,8 @@ namespace Segment
         {}
 
         // stream I/O
-        friend std::ostream& operator<<(std::ostream& out, const sSOI& SOI)
+        template <typename Output>
+        friend Output& operator<<(Output& out, const sSOI& SOI)
         {
             const auto& segment = SOI;
             out.write((const char*)&segment, sizeof(segment));
@@ -100,7 +102,8 @@ namespace Segment
         sAPP0& setYdensity(short _den) { set(y_density, { getHi(_den), getLo(_den) }); return *this; }
 
         // stream I/O
-        friend std::ostream& operator<<(std::ostream& out, const sAPP0& APP0)
+        template <typename Output>
+        friend Output& operator<<(Output& out, const sAPP0& APP0)
         {
             const auto& segment = APP0;
             out.write((const char*)&segment, sizeof(segment));
@@ -108,11 +111,11 @@ namespace Segment
         }
     };
     
-    // FF C0
+    // FF C0 (FF C2 for progressive)
     struct sSOF0
     {
         static const Byte num_components = 3;
-        const Bytes<2> marker;
+        Bytes<2> marker;
         const Bytes<2> len;   // HI/LO
                               // Constraint: 8 + num components * 3
                               // 1 component (Y) or 3 components (YCbCr)
@@ -153,9 +156,11 @@ namespace Segment
         sSOF0& setupCb(ComponentSetup::Subsampling subsample_mode, ComponentSetup::QuantizationTableID quantization_table) { component_setup[4] = subsample_mode; component_setup[5] = quantization_table; return *this; }
         sSOF0& setupCr(ComponentSetup::Subsampling subsample_mode, ComponentSetup::QuantizationTableID quantization_table) { component_setup[7] = subsample_mode; component_setup[8] = quantization_table; return *this; }
         sSOF0& setComponentSetup(std::initializer_list<Byte> comp_setup) { set(component_setup, comp_setup); return *this; }
+        sSOF0& setProgressive(bool progressive) { marker[1] = progressive ? 0xc2 : 0xc0; return *this; }
 
         // stream I/O
-        friend std::ostream& operator<<(std::ostream& out, const sSOF0& SOF0)
+        template <typename Output>
+        friend Output& operator<<(Output& out, const sSOF0& SOF0)
         {
             const auto& segment = SOF0;
             out.write((const char*)&segment, sizeof(segment));
@@ -185,33 +190,20 @@ namespace Segment
         {}
 
         // setter
-        sDHT& pushCodeData(vector<vector<int>> &codelength_symbols, Class cls, Destination dest) {
-            // codelength_symbols[0] is the symbol list with codelength 0
-            // codelength_symbols[1] is the symbol list with codelength 1
-            // ...
-            // codelength_symbols[16] is the symbol list with codelength 16 (MAX!)
-            // 
-            assert(codelength_symbols.size() == 17);
-
+        sDHT& pushCodeData(const vector<vector<int>> &codelength_symbols, Class cls, Destination dest) {
             HTs.resize(HTs.size() + 1);
+            fillTable(HTs.back(), codelength_symbols, cls, dest);
 
-            auto& HTinfo = HTs.back().HT_info;
-            auto& symbols = HTs.back().symbols;
-            auto& code_lengths = HTs.back().code_lengths;
-
-            HTinfo.assign((Byte)((cls << 4) | dest));
-
-            // symbols with codelength 0 shouldn't be possible and the DHT segment also starts with codelength 1
-            symbols.clear();
-            for (int i = 1; i < codelength_symbols.size(); ++i) {
-                auto& symbol_list = codelength_symbols[i];
-
-                // symbol order is arbitrary, see itu-t81.pdf Page 51
+            recalcLength();
+            return *this;
+        }
 
-                assert(symbol_list.size() < 256);
-                code_lengths[i-1] = static_cast<Byte>(symbol_list.size());
-                symbols.insert(end(symbols), begin(symbol_list), end(symbol_list));
-            }
+        // a segment with just this table. the storage of the one before is reused, so a segment that is kept
+        // around is filled again without allocating
+        sDHT& setCodeData(const vector<vector<int>> &codelength_symbols, Class cls, Destination dest) {
+            HTs.resize(1);
+            HTs[0].symbols.reserve(256);
+            fillTable(HTs[0], codelength_symbols, cls, dest);
 
             recalcLength();
             return *this;
@@ -224,7 +216,8 @@ namespace Segment
         }
 
         // stream I/O
-        friend std::ostream& operator<<(std::ostream& out, const sDHT& DHT)
+        template <typename Output>
+        friend Output& operator<<(Output& out, const sDHT& DHT)
         {
             const auto& segment = DHT;
             // write marker and length
@@ -242,6 +235,33 @@ namespace Segment
         }
 
     private:
+        static void fillTable(sHT& HT, const vector<vector<int>> &codelength_symbols, Class cls, Destination dest) {
+            // codelength_symbols[0] is the symbol list with codelength 0
+            // codelength_symbols[1] is the symbol list with codelength 1
+            // ...
+            // codelength_symbols[16] is the symbol list with codelength 16 (MAX!)
+            // 
+            assert(codelength_symbols.size() == 17);
+
+            auto& HTinfo = HT.HT_info;
+            auto& symbols = HT.symbols;
+            auto& code_lengths = HT.code_lengths;
+
+            HTinfo.assign((Byte)((cls << 4) | dest));
+
+            // symbols with codelength 0 shouldn't be possible and the DHT segment also starts with codelength 1
+            symbols.clear();
+            for (size_t i = 1; i < codelength_symbols.size(); ++i) {
+                auto& symbol_list = codelength_symbols[i];
+
+                // symbol order is arbitrary, see itu-t81.pdf Page 51
+
+                assert(symbol_list.size() < 256);
+                code_lengths[i-1] = static_cast<Byte>(symbol_list.size());
+                symbols.insert(end(symbols), begin(symbol_list), end(symbol_list));
+            }
+        }
+
         sDHT& setLen(short _len) { set(len, { getHi(_len), getLo(_len) }); return *this; }
         sDHT& recalcLength() {
             auto len = 2;
@@ -295,7 +315,8 @@ namespace Segment
         }
 
         // stream I/O
-        friend std::ostream& operator<<(std::ostream& out, const sDQT& DQT)
+        template <typename Output>
+        friend Output& operator<<(Output& out, const sDQT& DQT)
         {
             // marker and length
             out.write((const char*)&DQT, 4);
@@ -318,6 +339,32 @@ namespace Segment
         }
     };
     
+    // FF DD
+    struct sDRI
+    {
+        const Bytes<2> marker;
+        const Bytes<2> len;
+        Bytes<2> restart_interval;  // Fill that! HI/LO, MCUs between two RSTn markers
+
+        // defaults
+        sDRI()
+            : marker{ { 0xff, 0xdd } },
+            len{ { 0, 4 } },
+            restart_interval{ { 0, 0 } }
+        {}
+
+        // setter
+        sDRI& setRestartInterval(short _mcus) { set(restart_interval, { getHi(_mcus), getLo(_mcus) }); return *this; }
+
+        // stream I/O
+        template <typename Output>
+        friend Output& operator<<(Output& out, const sDRI& DRI)
+        {
+            out.write((const char*)&DRI, sizeof(DRI));
+            return out;
+        }
+    };
+
     // FF DA
     struct sSOS
     {
@@ -346,10 +393,30 @@ namespace Segment
         sSOS& setupCb(sDHT::Destination DC_table, sDHT::Destination AC_table) { component_setup[3] = (DC_table << 4) | AC_table; return *this; }
         sSOS& setupCr(sDHT::Destination DC_table, sDHT::Destination AC_table) { component_setup[5] = (DC_table << 4) | AC_table; return *this; }
 
+        // scans with other components than Y, Cb and Cr (in that order), the setupX functions don't apply then
+        sSOS& setComponentCount(Byte count) { assert(count >= 1 && count <= 3); num_components[0] = count; setLen(6 + 2 * count); return *this; }
+        sSOS& setupComponent(int index, ComponentSetup::ID component, sDHT::Destination DC_table, sDHT::Destination AC_table) {
+            component_setup[2 * index] = component;
+            component_setup[2 * index + 1] = (DC_table << 4) | AC_table;
+            return *this;
+        }
+        // scan of only one component (non-interleaved)
+        sSOS& setupSingle(ComponentSetup::ID component, sDHT::Destination DC_table, sDHT::Destination AC_table) {
+            return setComponentCount(1).setupComponent(0, component, DC_table, AC_table);
+        }
+
+        // progressive scans: zigzag positions start to end, successive approximation bits (high 0 for the first scan)
+        sSOS& setSpectralSelection(Byte start, Byte end) { blubb[0] = start; blubb[1] = end; return *this; }
+        sSOS& setSuccessiveApproximation(Byte high, Byte low) { blubb[2] = static_cast<Byte>((high << 4) | low); return *this; }
+
         // stream I/O
-        friend std::ostream& operator<<(std::ostream& out, const sSOS& SOS)
+        template <typename Output>
+        friend Output& operator<<(Output& out, const sSOS& SOS)
         {
-            out.write((const char*)&SOS, sizeof(SOS));
+            // marker, length and component count, the setup of the used components and the rest
+            out.write((const char*)&SOS, 5);
+            out.write((const char*)&SOS.component_setup[0], 2 * SOS.num_components[0]);
+            out.write((const char*)&SOS.blubb[0], SOS.blubb.size());
             return out;
         }
 
@@ -368,7 +435,8 @@ namespace Segment
         {}
 
         // stream I/O
-        friend std::ostream& operator<<(std::ostream& out, const sEOI& EOI)
+        template <typename Output>
+        friend Output& operator<<(Output& out, const sEOI& EOI)
         {
             const auto& segment = EOI;
             out.write((const char*)&segment, sizeof(segment));
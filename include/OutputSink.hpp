@@ -0,0 +1,112 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <string>
+#include <functional>
+#include <stdexcept>
+
+// destination of the encoded jpeg bytes. writeJPEG writes the segments and the scan into it and calls finish at the end
+class OutputSink {
+public:
+    virtual ~OutputSink() {}
+
+    void write(const uint8_t* data, size_t size) { if (size > 0) put(data, size); }
+    // same signature as std::ostream::write, so the jpeg segments can be written to both
+    void write(const char* data, size_t size) { write(reinterpret_cast<const uint8_t*>(data), size); }
+
+    // everything is written, buffered bytes have to go out now
+    virtual void finish() {}
+
+protected:
+    virtual void put(const uint8_t* data, size_t size) = 0;
+};
+
+// collects everything in a growing vector
+class MemorySink : public OutputSink {
+public:
+    explicit MemorySink(size_t expected_bytes = 0) { bytes.reserve(expected_bytes); }
+
+    const std::vector<uint8_t>& data() const { return bytes; }
+    size_t size() const { return bytes.size(); }
+    void clear() { bytes.clear(); }
+
+protected:
+    void put(const uint8_t* data, size_t size) override { bytes.insert(bytes.end(), data, data + size); }
+
+private:
+    std::vector<uint8_t> bytes;
+};
+
+// writes into a buffer of the caller, throws std::length_error if it's too small.
+// a buffer of maxEncodedSize(width, height, options) bytes (see Encoder.hpp) is always large enough for those options,
+// maxEncodedSize(width, height) only for the default baseline 4:2:0 ones
+class FixedBufferSink : public OutputSink {
+public:
+    FixedBufferSink(uint8_t* buffer, size_t capacity)
+        : buffer(buffer), capacity(capacity), pos(0)
+    {}
+
+    size_t size() const { return pos; }
+
+protected:
+    void put(const uint8_t* data, size_t size) override;
+
+private:
+    uint8_t* buffer;
+    size_t capacity;
+    size_t pos;
+};
+
+// writes to a file descriptor (file, pipe, socket) that stays open. small segments are collected in a buffer,
+// large blocks like the scan go out directly with as few write calls as possible. throws std::runtime_error on errors
+class FileDescriptorSink : public OutputSink {
+public:
+    explicit FileDescriptorSink(int fd, size_t buffer_size = 64 * 1024);
+    ~FileDescriptorSink();
+
+    void finish() override { flushBuffer(); }
+
+protected:
+    void put(const uint8_t* data, size_t size) override;
+
+    int fd;
+
+private:
+    void flushBuffer();
+    void writeAll(const uint8_t* data, size_t size);
+
+    std::vector<uint8_t> buffer;
+    size_t pos;
+};
+
+// opens (and truncates) the file and closes it again when the sink is destroyed
+class FileSink : public FileDescriptorSink {
+public:
+    explicit FileSink(const std::string& path);
+    ~FileSink();
+
+private:
+    FileSink(const FileSink&);
+    FileSink& operator=(const FileSink&);
+};
+
+// hands the bytes to a callback in chunks of chunk_size bytes (the last one may be smaller),
+// e.g. for sending them over the network or uploading them in parts
+class CallbackSink : public OutputSink {
+public:
+    typedef std::function<void(const uint8_t* data, size_t size)> Callback;
+
+    explicit CallbackSink(Callback callback, size_t chunk_size = 64 * 1024);
+
+    void finish() override;
+
+protected:
+    void put(const uint8_t* data, size_t size) override;
+
+private:
+    Callback callback;
+    std::vector<uint8_t> chunk;
+    size_t chunk_size;
+};
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "OutputSink.hpp"
+#include "BitWriter.hpp"
+
+typedef unsigned int uint;
+
+// one scan of a progressive jpeg (SOF2): the zigzag positions spectral_start to spectral_end of the given components
+// (0 Y, 1 Cb, 2 Cr), divided by 2^approximation_low. approximation_high is 0 for the first scan of these coefficients
+// and the approximation_low of the scan before for a refinement (which adds one more bit).
+// only DC scans (0 to 0) can have more than one component
+struct ProgressiveScan {
+    std::vector<int> components;
+    uint8_t spectral_start, spectral_end;
+    uint8_t approximation_high, approximation_low;
+};
+
+typedef std::vector<ProgressiveScan> ScanScript;
+
+// the progression libjpeg uses for YCbCr images: DC first, then a few low Y frequencies, chroma and the rest of Y,
+// the last bits of everything at the end
+ScanScript defaultScanScript();
+
+// throws std::invalid_argument if the scans don't form a valid and complete progression
+void checkScanScript(const ScanScript& script);
+
+// text form of a script, one scan per ';': "components: spectral_start spectral_end approximation_high approximation_low",
+// e.g. "0 1 2: 0 0 0 1; 0: 1 5 0 2; ...". throws std::invalid_argument on syntax errors and invalid scripts
+ScanScript parseScanScript(const std::string& text);
+
+// quantized coefficients of one component, 8x8 blocks next to each other, padded to whole MCUs
+struct ProgressiveComponent {
+    const int* coefficients;    // row major
+    size_t stride;              // of a row in ints
+    uint width, height;         // of the component in pixels (without the padding)
+    uint h_blocks, v_blocks;    // blocks per MCU
+};
+
+// writes DHT, SOS and the entropy coded data of every scan of the script. every scan gets its own optimized huffman
+// tables, so the symbols are counted in one pass and coded in a second one. the scans are coded into writer one after another
+void writeProgressiveScans(OutputSink& sink, const ProgressiveComponent components[3], uint mcus_x, uint mcus_y,
+                           const ScanScript& script, BitWriter& writer);
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <string>
+
+#include "Huffman.hpp"
+
+// symbol counts of the four huffman tables of a baseline jpeg
+struct SymbolStatistics {
+    SymbolHistogram Y_DC, Y_AC, C_DC, C_AC;
+
+    SymbolStatistics& operator+=(const SymbolStatistics& other) {
+        Y_DC += other.Y_DC;
+        Y_AC += other.Y_AC;
+        C_DC += other.C_DC;
+        C_AC += other.C_AC;
+        return *this;
+    }
+};
+
+// huffman tables trained on a set of similar images (product photos, scans, map tiles, ...).
+// every symbol a DC or AC table can be asked for has a code, so a profile can code any image in one pass
+struct TableProfile {
+    SymbolsPerLength Y_DC, Y_AC, C_DC, C_AC;
+};
+
+// builds the code lengths from the accumulated statistics, unseen symbols get the longest codes
+TableProfile trainTableProfile(SymbolStatistics statistics);
+
+// plain text file: a name line followed by the 16 code counts and the symbols in code order for every table.
+// loading checks the tables and throws a std::runtime_error if the file is broken
+void saveTableProfile(const TableProfile& profile, const std::string& path);
+TableProfile loadTableProfile(const std::string& path);
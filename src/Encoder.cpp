@@ -0,0 +1,1091 @@
+#include "Encoder.hpp"
+
+#include <cmath>
+#include <stdexcept>
+#include <tuple>
+#include <omp.h>
+
+#include "JpegSegments.hpp"
+#include "Dct.hpp"
+
+//
+// OPTIONS
+//
+const QuantizationTable& standardLuminanceTable()
+{
+    static const QuantizationTable table = { {
+        16, 11, 10, 16, 24, 40, 51, 61,
+        12, 12, 14, 19, 26, 58, 60, 55,
+        14, 13, 16, 24, 40, 57, 69, 56,
+        14, 17, 22, 29, 51, 87, 80, 62,
+        18, 22, 37, 56, 68, 109, 103, 77,
+        24, 35, 55, 64, 81, 104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101,
+        72, 92, 95, 98, 112, 100, 103, 99
+    } };
+    return table;
+}
+
+const QuantizationTable& standardChrominanceTable()
+{
+    static const QuantizationTable table = { {
+        17, 18, 24, 47, 99, 99, 99, 99,
+        18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99,
+        47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99
+    } };
+    return table;
+}
+
+EncoderOptions::EncoderOptions()
+    : subsampling(Image::S420_m),
+    dct_mode(Image::Arai),
+    quantization_y(standardLuminanceTable()), quantization_c(standardChrominanceTable()),
+    quality(50),
+    target_size(0),
+    huffman_mode(Image::Optimized),
+    table_profile(nullptr),
+    restart_interval(0),
+    interleaved(true),
+    scan_script(nullptr),
+    threads(0)
+{}
+
+QuantizationTable scaleQuantizationTable(const QuantizationTable& table, int quality)
+{
+    assert(quality >= 1 && quality <= 100);
+
+    // percentage of the table entries
+    const long scale = quality < 50 ? 5000 / quality : 200 - 2 * quality;
+
+    QuantizationTable scaled;
+    for (int i = 0; i < 64; ++i)
+        scaled[i] = static_cast<Byte>(std::min(std::max((table[i] * scale + 50) / 100, 1L), 255L));
+    return scaled;
+}
+
+// Y blocks per MCU horizontally and vertically
+static void samplingFactors(Image::SubsamplingMode subsampling, uint& luma_h, uint& luma_v)
+{
+    switch (subsampling) {
+        case Image::S444: luma_h = 1; luma_v = 1; break;
+        case Image::S422: luma_h = 2; luma_v = 1; break;
+        case Image::S411: luma_h = 4; luma_v = 1; break;
+        default:          luma_h = 2; luma_v = 2; break;
+    }
+}
+
+size_t maxEncodedSize(uint width, uint height, const EncoderOptions& options)
+{
+    // all segments besides the scans: SOI, APP0, 2 DQT, SOF0, 4 DHT with at most 256 symbols each, DRI,
+    // one SOS for all components (14 bytes) or three with one each (10 bytes) and EOI
+    const size_t header_bytes = 2 + 18 + 2 * 69 + 19 + 4 * (4 + 17 + 256) + 6 + 3 * 10 + 2;
+
+    // worst case of a block: DC and all 63 AC coefficients with the longest code (16 bits) and category (11 and 10 bits),
+    // a ZRL never costs more than the zeros it replaces would, plus an EOB. every byte may need stuffing
+    const size_t block_bits = (16 + 11) + 63 * (16 + 10) + 16;
+    const size_t block_bytes = 2 * ((block_bits + 7) / 8);
+
+    // MCUs with luma_h x luma_v Y blocks, one Cb and one Cr block
+    uint luma_h, luma_v;
+    samplingFactors(options.subsampling, luma_h, luma_v);
+    const uint mcu_width = luma_h * blocksize, mcu_height = luma_v * blocksize;
+    const size_t mcus = static_cast<size_t>((width + mcu_width - 1) / mcu_width) * ((height + mcu_height - 1) / mcu_height);
+
+    if (options.scan_script) {
+        // every scan has its own DHT (at most a DC or AC table for Y and one for the chroma) and SOS segment.
+        // a block costs at most the baseline bits for every coefficient of the scan (a refinement only 16 + 1 bits
+        // and the correction bits) and one EOBn run (16 bit code and 14 bits of run length) that ends in it.
+        // a DC refinement is a single bit per block
+        const size_t blocks[] = { mcus * luma_h * luma_v, mcus, mcus };
+        size_t size = header_bytes;
+        for (const auto& scan : *options.scan_script) {
+            size_t bits_per_block = 1;
+            if (scan.spectral_start > 0)
+                bits_per_block = (scan.spectral_end - scan.spectral_start + 1) * (16 + 10) + 16 + 14;
+            else if (scan.approximation_high == 0)
+                bits_per_block = 16 + 11;
+
+            size_t scan_bits = 0;
+            for (int c : scan.components) {
+                assert(c >= 0 && c < 3);
+                scan_bits += blocks[c] * bits_per_block;
+            }
+            size += 2 * (4 + 17 + 256) + 14 + 2 * ((scan_bits + 7) / 8);
+        }
+        return size;
+    }
+
+    // with a restart interval of 1 in non-interleaved scans every block ends with a stuffed padding byte and a RSTn marker
+    const size_t restart_bytes = 2 + 2;
+
+    return header_bytes + mcus * (luma_h * luma_v + 2) * (block_bytes + restart_bytes);
+}
+
+// sets the number of OpenMP threads for one encode and restores it afterwards
+class ThreadCount {
+public:
+    explicit ThreadCount(int threads)
+        : previous(omp_get_max_threads()), changed(threads > 0)
+    {
+        if (changed)
+            omp_set_num_threads(threads);
+    }
+    ~ThreadCount()
+    {
+        if (changed)
+            omp_set_num_threads(previous);
+    }
+
+private:
+    int previous;
+    bool changed;
+};
+
+//
+// CONSTRUCTORS
+//
+Encoder::Encoder()
+    : real_width(0), real_height(0),
+    luma_h(2), luma_v(2),
+    mcus_x(0), mcus_y(0),
+    quantization_set(0),
+    scan_part_count(0),
+    table_header_mode(Image::Optimized), // nothing cached yet, Optimized tables never are
+    last_quality(0)
+{
+    base_y.fill(0);
+    base_c.fill(0);
+    useQuality(standardLuminanceTable(), standardChrominanceTable(), 50);
+}
+
+Encoder::Encoder(uint max_width, uint max_height)
+    : Encoder()
+{
+    reserve(max_width, max_height);
+}
+
+void Encoder::reserve(uint max_width, uint max_height)
+{
+    // padded to whole MCUs like the images (4:4:4 needs the most chroma, 4:1:1 the widest padding)
+    const size_t width = (max_width + 31) / 32 * 32;
+    const size_t height = (max_height + 15) / 16 * 16;
+
+    DctY.reserve(width * height);
+    DctCb.reserve(width * height);
+    DctCr.reserve(width * height);
+    QY.reserve(width * height);
+    QCb.reserve(width * height);
+    QCr.reserve(width * height);
+
+    // about a quarter byte per pixel is plenty for most images, the writer grows if not
+    useScanParts(1);
+    scan_parts[0] = BitWriter(width * height / 4);
+}
+
+void Encoder::useQuality(const QuantizationTable& table_y, const QuantizationTable& table_c, int quality)
+{
+    if (table_y != base_y || table_c != base_c) {
+        base_y = table_y;
+        base_c = table_c;
+        quantization_sets.clear();
+    }
+
+    for (size_t i = 0; i < quantization_sets.size(); ++i) {
+        if (quantization_sets[i].quality == quality) {
+            quantization_set = i;
+            return;
+        }
+    }
+
+    quantization_sets.emplace_back();
+    quantization_set = quantization_sets.size() - 1;
+    auto& set = quantization_sets.back();
+    set.quality = quality;
+    set.table_y = scaleQuantizationTable(table_y, quality);
+    set.table_c = scaleQuantizationTable(table_c, quality);
+
+    // quantization is a multiplication with the reciprocals
+    std::vector<Byte> zigzag_y(64), zigzag_c(64);
+    for (int i = 0; i < 64; ++i) {
+        set.reciprocal_y[i] = 1. / set.table_y[i];
+        set.reciprocal_c[i] = 1. / set.table_c[i];
+        zigzag_y[zigzag_index[i]] = set.table_y[i];
+        zigzag_c[zigzag_index[i]] = set.table_c[i];
+    }
+
+    using namespace Segment;
+    set.header << sSOI()
+        << sAPP0()
+        << sDQT().pushQuantizationTable(zigzag_y, ComponentSetup::QuantizationTableID::Zero)
+        << sDQT().pushQuantizationTable(zigzag_c, ComponentSetup::QuantizationTableID::One);
+}
+
+void checkEncoderOptions(const Image& image, const EncoderOptions& options)
+{
+    if (options.scan_script)
+        checkScanScript(*options.scan_script);
+
+    for (int i = 0; i < 64; ++i) {
+        if (options.quantization_y[i] == 0 || options.quantization_c[i] == 0)
+            throw std::invalid_argument("quantization table entries have to be 1 to 255");
+    }
+    if (options.quality < 1 || options.quality > 100)
+        throw std::invalid_argument("the quality has to be 1 to 100");
+    if (options.restart_interval > 65535)
+        throw std::invalid_argument("the restart interval is at most 65535 MCUs");
+    if (options.huffman_mode == Image::Profile && !options.table_profile)
+        throw std::invalid_argument("the profile huffman mode needs a table profile");
+
+    // the chroma of subsampled input is taken as it is
+    uint h, v;
+    samplingFactors(options.subsampling, h, v);
+    if (image.isSubsampled() && (image.subsample_width * h != image.width || image.subsample_height * v != image.height))
+        throw std::invalid_argument("subsampled input needs the subsampling of its chroma planes");
+}
+
+void Encoder::componentSizes(uint widths[3], uint heights[3]) const
+{
+    // chroma has the size divided by the sampling factors of Y (rounded up)
+    widths[0] = real_width;
+    heights[0] = real_height;
+    widths[1] = widths[2] = (real_width + luma_h - 1) / luma_h;
+    heights[1] = heights[2] = (real_height + luma_v - 1) / luma_v;
+}
+
+//
+// TRANSFORMATION
+//
+
+// rows x columns samples of m from (top, left) to dst, the columns from available on repeat the last one
+static void copySamples(const matrix<PixelDataType>& m, uint top, uint left, uint rows, uint columns, uint available, PixelDataType* dst)
+{
+    for (uint row = 0; row < rows; ++row) {
+        const auto* src = &m(top + row, left);
+        for (uint column = 0; column < columns; ++column)
+            dst[row * columns + column] = src[std::min(column, available - 1)];
+    }
+}
+
+// the chroma of one MCU at src into an 8x8 block like Image::applySubsampling does it
+static void subsampleChroma(Image::SubsamplingMode subsampling, const PixelDataType* src, size_t stride, PixelDataType* dst)
+{
+    uint h, v;
+    samplingFactors(subsampling, h, v);
+
+    for (uint row = 0; row < 8; ++row) {
+        const auto* upper = src + v * row * stride;
+        const auto* lower = upper + stride;
+        for (uint column = 0; column < 8; ++column) {
+            const uint x = h * column;
+            if (subsampling == Image::S420_m)
+                dst[row * 8 + column] = (upper[x] + upper[x + 1] + (lower[x] + lower[x + 1])) / 4;
+            else if (subsampling == Image::S420_lm)
+                dst[row * 8 + column] = (upper[x] + lower[x]) / 2;
+            else
+                dst[row * 8 + column] = upper[x];
+        }
+    }
+}
+
+// the reference kernels of Image::applyDCT work on ublas ranges, the block is copied in and out
+static void dctBlock(Image::DCTMode dct_mode, const PixelDataType* x, size_t x_stride, PixelDataType* y, size_t y_stride)
+{
+    if (dct_mode == Image::Arai) {
+        dctArai(x, x_stride, y, y_stride);
+        return;
+    }
+
+    using boost::numeric::ublas::range;
+    matrix<PixelDataType> in(blocksize, blocksize), out(blocksize, blocksize);
+    for (uint row = 0; row < blocksize; ++row)
+        std::copy(x + row * x_stride, x + row * x_stride + blocksize, &in(row, 0));
+
+    const matrix_range<matrix<PixelDataType>> in_range(in, range(0, blocksize), range(0, blocksize));
+    matrix_range<matrix<PixelDataType>> out_range(out, range(0, blocksize), range(0, blocksize));
+    if (dct_mode == Image::Simple)
+        dctDirect(in_range, out_range);
+    else
+        dctMat(in_range, out_range);
+
+    for (uint row = 0; row < blocksize; ++row)
+        std::copy(&out(row, 0), &out(row, 0) + blocksize, y + row * y_stride);
+}
+
+void Encoder::transform(const Image& image, Image::SubsamplingMode subsampling, Image::DCTMode dct_mode)
+{
+    // the loaders pad every image to 16x16 pixels, the 32 pixel wide 4:1:1 MCUs repeat the last column
+    assert(image.width % 16 == 0 && image.height % 16 == 0);
+
+    samplingFactors(subsampling, luma_h, luma_v);
+    const uint mcu_width = luma_h * blocksize, mcu_height = luma_v * blocksize;
+
+    real_width = image.real_width;
+    real_height = image.real_height;
+    // the MCUs a decoder expects from the size in the SOF, not the ones of the padded image
+    mcus_x = (real_width + mcu_width - 1) / mcu_width;
+    mcus_y = (real_height + mcu_height - 1) / mcu_height;
+
+    DctY.resize(mcus_x * mcu_width, mcus_y * mcu_height);
+    DctCb.resize(mcus_x * blocksize, mcus_y * blocksize);
+    DctCr.resize(mcus_x * blocksize, mcus_y * blocksize);
+
+    // RGB is converted pixel by pixel, subsampled YUV input comes with its chroma planes (checkEncoderOptions),
+    // any other chroma is subsampled here
+    const bool rgb = image.colorSpace() == Image::RGB;
+    const bool subsampled = image.isSubsampled();
+    const bool full_chroma = luma_h == 1 && luma_v == 1;
+    assert(!rgb || !subsampled);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int my = 0; my < static_cast<int>(mcus_y); ++my) {
+        // one MCU (at most 32x16 pixels) in YCbCr, the chroma before and after subsampling
+        PixelDataType y[32 * 16], cb[32 * 16], cr[32 * 16];
+        PixelDataType cb_sub[8 * 8], cr_sub[8 * 8];
+
+        for (uint mx = 0; mx < mcus_x; ++mx) {
+            const uint top = mcu_height * my, left = mcu_width * mx;
+            const uint columns = std::min(mcu_width, image.width - left);
+
+            const PixelDataType* y_src = y;
+            size_t y_stride = mcu_width;
+            const PixelDataType *cb_full = cb, *cr_full = cr;
+            size_t full_stride = mcu_width;
+            const PixelDataType* cb_src = cb_sub;
+            const PixelDataType* cr_src = cr_sub;
+            size_t c_stride = 8;
+
+            if (rgb) {
+                for (uint row = 0; row < mcu_height; ++row) {
+                    const auto* r = &image.R(top + row, left);
+                    const auto* g = &image.G(top + row, left);
+                    const auto* b = &image.B(top + row, left);
+                    for (uint column = 0; column < mcu_width; ++column) {
+                        auto i = row * mcu_width + column;
+                        auto c = std::min(column, columns - 1);
+                        convertPixelToYCbCr(r[c], g[c], b[c], y[i], cb[i], cr[i]);
+                    }
+                }
+            }
+            else if (columns == mcu_width) {
+                y_src = &image.Y(top, left);
+                y_stride = image.Y.size2();
+                if (!subsampled) {
+                    cb_full = &image.Cb(top, left);
+                    cr_full = &image.Cr(top, left);
+                    full_stride = image.Cb.size2();
+                }
+            }
+            else {
+                copySamples(image.Y, top, left, mcu_height, mcu_width, columns, y);
+                if (!subsampled) {
+                    copySamples(image.Cb, top, left, mcu_height, mcu_width, columns, cb);
+                    copySamples(image.Cr, top, left, mcu_height, mcu_width, columns, cr);
+                }
+            }
+
+            if (subsampled) {
+                const uint c_top = top / luma_v, c_left = left / luma_h;
+                const uint c_columns = columns / luma_h;
+                if (c_columns == blocksize) {
+                    cb_src = &image.Cb(c_top, c_left);
+                    cr_src = &image.Cr(c_top, c_left);
+                    c_stride = image.Cb.size2();
+                }
+                else {
+                    copySamples(image.Cb, c_top, c_left, blocksize, blocksize, c_columns, cb_sub);
+                    copySamples(image.Cr, c_top, c_left, blocksize, blocksize, c_columns, cr_sub);
+                }
+            }
+            else if (full_chroma) {
+                cb_src = cb_full;
+                cr_src = cr_full;
+                c_stride = full_stride;
+            }
+            else {
+                subsampleChroma(subsampling, cb_full, full_stride, cb_sub);
+                subsampleChroma(subsampling, cr_full, full_stride, cr_sub);
+            }
+
+            // luma_h x luma_v Y blocks, one Cb and one Cr block
+            for (uint by = 0; by < luma_v; ++by) {
+                for (uint bx = 0; bx < luma_h; ++bx)
+                    dctBlock(dct_mode, y_src + by * blocksize * y_stride + bx * blocksize, y_stride,
+                             &DctY(top + by * blocksize, left + bx * blocksize), DctY.stride());
+            }
+            dctBlock(dct_mode, cb_src, c_stride, &DctCb(my * blocksize, mx * blocksize), DctCb.stride());
+            dctBlock(dct_mode, cr_src, c_stride, &DctCr(my * blocksize, mx * blocksize), DctCr.stride());
+        }
+    }
+}
+
+// every coefficient times the reciprocal of its quantization table entry, rounded
+// only the MCU rows (of mcu_height rows) with an index divisible by mcu_row_step, and the last block of the
+// MCU row before each of them that their DC prediction starts from
+static void quantizePlane(const Plane<PixelDataType>& dct, const PixelDataType reciprocals[64], Plane<int>& quantized,
+                          uint mcu_height, uint mcu_row_step)
+{
+    quantized.resize(dct.width, dct.height);
+
+#pragma omp parallel for
+    for (int row = 0; row < static_cast<int>(dct.height); ++row) {
+        const uint mcu_row = row / mcu_height;
+        uint first_column = 0;
+        if (mcu_row % mcu_row_step != 0) {
+            if ((mcu_row + 1) % mcu_row_step != 0 || row % mcu_height < mcu_height - 8)
+                continue;
+            first_column = dct.width - 8;
+        }
+        const auto* reciprocal_row = reciprocals + 8 * (row % 8);
+        const auto* src = &dct(row, 0);
+        auto* dst = &quantized(row, 0);
+        for (uint column = first_column; column < dct.width; ++column)
+            dst[column] = static_cast<int>(std::round(src[column] * reciprocal_row[column % 8]));
+    }
+}
+
+void Encoder::quantize(uint mcu_row_step)
+{
+    const auto& set = quantization_sets[quantization_set];
+    quantizePlane(DctY,  set.reciprocal_y, QY,  luma_v * blocksize, mcu_row_step);
+    quantizePlane(DctCb, set.reciprocal_c, QCb, blocksize, mcu_row_step);
+    quantizePlane(DctCr, set.reciprocal_c, QCr, blocksize, mcu_row_step);
+}
+
+//
+// STATISTICS
+//
+void Encoder::collectSampledStatistics(uint mcu_row_step, uint restart_interval) {
+    assert(mcu_row_step > 0);
+
+    HistogramY_DC.fill(0);
+    HistogramY_AC.fill(0);
+    HistogramC_DC.fill(0);
+    HistogramC_AC.fill(0);
+
+    const int mcu_rows = mcus_y;
+    const uint mcus_per_row = mcus_x;
+    const int step = mcu_row_step;
+
+#pragma omp parallel
+    {
+        SymbolHistogram y_dc, y_ac, c_dc, c_ac;
+
+        auto count_y_dc = [&](uint8_t symbol, CategoryBits) { ++y_dc[symbol]; };
+        auto count_y_ac = [&](uint8_t symbol, CategoryBits) { ++y_ac[symbol]; };
+        auto count_c_dc = [&](uint8_t symbol, CategoryBits) { ++c_dc[symbol]; };
+        auto count_c_ac = [&](uint8_t symbol, CategoryBits) { ++c_ac[symbol]; };
+
+#pragma omp for schedule(dynamic)
+        for (int mcu_row = 0; mcu_row < mcu_rows; mcu_row += step) {
+            const uint h = mcu_row * blocksize;
+            const uint y_top = h * luma_v;
+
+            // the DC predictions start with the last blocks of the previous MCU row, like in the full scan
+            int dc_y = 0, dc_cb = 0, dc_cr = 0;
+            if (h > 0) {
+                dc_y  = QY(y_top - blocksize, QY.width - blocksize);
+                dc_cb = QCb(h - blocksize, QCb.width - blocksize);
+                dc_cr = QCr(h - blocksize, QCr.width - blocksize);
+            }
+
+            for (uint w = 0; w < QCb.width; w += blocksize) {
+                // the predictions start again at every restart marker
+                const uint mcu = mcu_row * mcus_per_row + w / blocksize;
+                if (restart_interval > 0 && mcu % restart_interval == 0)
+                    dc_y = dc_cb = dc_cr = 0;
+
+                for (uint by = 0; by < luma_v; ++by) {
+                    for (uint bx = 0; bx < luma_h; ++bx)
+                        scanBlockSymbols(&QY(y_top + by * blocksize, w * luma_h + bx * blocksize), QY.stride(), dc_y, count_y_dc, count_y_ac);
+                }
+
+                scanBlockSymbols(&QCb(h, w), QCb.stride(), dc_cb, count_c_dc, count_c_ac);
+                scanBlockSymbols(&QCr(h, w), QCr.stride(), dc_cr, count_c_dc, count_c_ac);
+            }
+        }
+
+#pragma omp critical
+        {
+            HistogramY_DC += y_dc;
+            HistogramY_AC += y_ac;
+            HistogramC_DC += c_dc;
+            HistogramC_AC += c_ac;
+        }
+    }
+}
+
+// a non-interleaved scan only has the blocks that cover the component, not the padding up to whole MCUs.
+// calls block_fn(index, block, stride) for them in raster order
+template <typename BlockFn>
+static void forEachComponentBlock(const Plane<int>& Q, uint component_width, uint component_height, BlockFn block_fn)
+{
+    const uint blocks_x = (component_width + blocksize - 1) / blocksize;
+    const uint blocks_y = (component_height + blocksize - 1) / blocksize;
+
+    uint index = 0;
+    for (uint by = 0; by < blocks_y; ++by) {
+        for (uint bx = 0; bx < blocks_x; ++bx)
+            block_fn(index++, &Q(by * blocksize, bx * blocksize), Q.stride());
+    }
+}
+
+void Encoder::collectComponentStatistics(uint restart_interval)
+{
+    const Plane<int>* components[] = { &QY, &QCb, &QCr };
+    uint widths[3], heights[3];
+    componentSizes(widths, heights);
+    SymbolHistogram dc[3], ac[3];
+
+#pragma omp parallel for
+    for (int c = 0; c < 3; ++c) {
+        dc[c].fill(0);
+        ac[c].fill(0);
+        int previous_dc = 0;
+
+        forEachComponentBlock(*components[c], widths[c], heights[c], [&](uint index, const int* block, size_t stride) {
+            if (restart_interval > 0 && index % restart_interval == 0)
+                previous_dc = 0;
+            scanBlockSymbols(block, stride, previous_dc,
+                [&](uint8_t symbol, CategoryBits) { ++dc[c][symbol]; },
+                [&](uint8_t symbol, CategoryBits) { ++ac[c][symbol]; });
+        });
+    }
+
+    HistogramY_DC = dc[0];
+    HistogramY_AC = ac[0];
+    HistogramC_DC = dc[1];
+    HistogramC_AC = ac[1];
+    HistogramC_DC += dc[2];
+    HistogramC_AC += ac[2];
+}
+
+SymbolStatistics Encoder::collectStatistics(const Image& image, const EncoderOptions& options)
+{
+    checkEncoderOptions(image, options);
+    ThreadCount thread_count(options.threads);
+
+    useQuality(options.quantization_y, options.quantization_c, options.quality);
+    transform(image, options.subsampling, options.dct_mode);
+    quantize();
+
+    collectSampledStatistics(1, 0);
+    SymbolStatistics statistics;
+    statistics.Y_DC = HistogramY_DC;
+    statistics.Y_AC = HistogramY_AC;
+    statistics.C_DC = HistogramC_DC;
+    statistics.C_AC = HistogramC_AC;
+    return statistics;
+}
+
+//
+// ENTROPY CODING
+//
+void Encoder::useScanParts(uint count)
+{
+    // the vector never shrinks, so the buffers of all writers are kept
+    if (scan_parts.size() < count)
+        scan_parts.resize(count);
+    scan_part_count = count;
+
+    for (uint i = 0; i < count; ++i)
+        scan_parts[i].clear();
+}
+
+void Encoder::encodeMCUs(uint first_mcu, uint end_mcu,
+                         const CodeTable &Y_DC,
+                         const CodeTable &Y_AC,
+                         const CodeTable &C_DC,
+                         const CodeTable &C_AC,
+                         BitWriter& stream,
+                         bool continue_prediction) const
+{
+    const uint mcus_per_row = mcus_x;
+    int dc_y = 0, dc_cb = 0, dc_cr = 0;
+
+    // the predictions are the DC values of the last blocks of the MCU before
+    if (continue_prediction && first_mcu > 0) {
+        const uint h = ((first_mcu - 1) / mcus_per_row) * blocksize;
+        const uint w = ((first_mcu - 1) % mcus_per_row) * blocksize;
+        dc_y  = QY((h + blocksize) * luma_v - blocksize, (w + blocksize) * luma_h - blocksize);
+        dc_cb = QCb(h, w);
+        dc_cr = QCr(h, w);
+    }
+
+    // one MCU: luma_h x luma_v Y blocks, one Cb and one Cr block
+    for (uint mcu = first_mcu; mcu < end_mcu; ++mcu) {
+        const uint h = (mcu / mcus_per_row) * blocksize;
+        const uint w = (mcu % mcus_per_row) * blocksize;
+
+        for (uint by = 0; by < luma_v; ++by) {
+            for (uint bx = 0; bx < luma_h; ++bx)
+                encodeBlock(&QY(h * luma_v + by * blocksize, w * luma_h + bx * blocksize), QY.stride(), dc_y, Y_DC, Y_AC, stream);
+        }
+
+        encodeBlock(&QCb(h, w), QCb.stride(), dc_cb, C_DC, C_AC, stream);
+        encodeBlock(&QCr(h, w), QCr.stride(), dc_cr, C_DC, C_AC, stream);
+    }
+}
+
+void Encoder::encodeScan(const CodeTable &Y_DC,
+                         const CodeTable &Y_AC,
+                         const CodeTable &C_DC,
+                         const CodeTable &C_AC,
+                         uint restart_interval)
+{
+    const uint mcus = mcus_x * mcus_y;
+
+    if (restart_interval == 0 || restart_interval >= mcus) {
+        if (omp_get_max_threads() > 1 && mcus_y > 1) {
+            encodeScanParallel(Y_DC, Y_AC, C_DC, C_AC);
+            return;
+        }
+
+        useScanParts(1);
+        encodeMCUs(0, mcus, Y_DC, Y_AC, C_DC, C_AC, scan_parts[0]);
+        scan_parts[0].flush();
+        return;
+    }
+
+    // the intervals don't depend on each other (DC prediction starts at 0, every interval ends byte aligned),
+    // so they are coded in parallel. the RSTn markers go between them when they are written
+    const int intervals = (mcus + restart_interval - 1) / restart_interval;
+    useScanParts(intervals);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < intervals; ++i) {
+        const uint first_mcu = i * restart_interval;
+        const uint end_mcu = std::min(first_mcu + restart_interval, mcus);
+
+        encodeMCUs(first_mcu, end_mcu, Y_DC, Y_AC, C_DC, C_AC, scan_parts[i]);
+        scan_parts[i].flush();
+    }
+}
+
+// the bits of src (zero padded to whole bytes) shifted by shift (< 8) bits: byte j of the result
+static inline uint8_t shiftedByte(const uint8_t* src, size_t src_bytes, size_t j, int shift)
+{
+    uint8_t current = j < src_bytes ? src[j] : 0;
+    if (shift == 0)
+        return current;
+    uint8_t previous = j > 0 ? src[j - 1] : 0;
+    return static_cast<uint8_t>((previous << (8 - shift)) | (current >> shift));
+}
+
+void Encoder::encodeScanParallel(const CodeTable &Y_DC,
+                                 const CodeTable &Y_AC,
+                                 const CodeTable &C_DC,
+                                 const CodeTable &C_AC)
+{
+    // every MCU row is coded on its own (DC prediction continues from the row before) without stuffing
+    const uint mcus_per_row = mcus_x;
+    const int mcu_rows = mcus_y;
+
+    while (row_streams.size() < static_cast<size_t>(mcu_rows))
+        row_streams.emplace_back(0, false);
+    row_offsets.resize(mcu_rows + 1);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int row = 0; row < mcu_rows; ++row) {
+        auto& stream = row_streams[row];
+        stream.clear();
+        encodeMCUs(row * mcus_per_row, (row + 1) * mcus_per_row, Y_DC, Y_AC, C_DC, C_AC, stream, true);
+        row_offsets[row + 1] = stream.size();
+
+        // zeros up to the next byte, so flush doesn't pad with ones
+        stream.push_back_LSB_mode(0, (8 - stream.size() % 8) % 8);
+        stream.flush();
+    }
+
+    // exact bit offset of every row in the scan
+    auto& offsets = row_offsets;
+    offsets[0] = 0;
+    for (int row = 0; row < mcu_rows; ++row)
+        offsets[row + 1] += offsets[row];
+    const size_t total_bits = offsets[mcu_rows];
+
+    // the rows are shifted to their offsets. the bytes a row shares with its neighbours are put together
+    // afterwards, all others belong to exactly one row
+    auto& scan = joined_rows;
+    scan.assign((total_bits + 7) / 8, 0);
+
+#pragma omp parallel for schedule(dynamic)
+    for (int row = 0; row < mcu_rows; ++row) {
+        const auto& stream = row_streams[row];
+        if (offsets[row + 1] == offsets[row])
+            continue;
+
+        const size_t first = offsets[row] / 8;
+        const size_t last = (offsets[row + 1] - 1) / 8;
+        const int shift = offsets[row] % 8;
+        for (size_t j = 1; first + j < last; ++j)
+            scan[first + j] = shiftedByte(stream.data(), stream.byteCount(), j, shift);
+    }
+
+    for (int row = 0; row < mcu_rows; ++row) {
+        const auto& stream = row_streams[row];
+        if (offsets[row + 1] == offsets[row])
+            continue;
+
+        const size_t first = offsets[row] / 8;
+        const size_t last = (offsets[row + 1] - 1) / 8;
+        const int shift = offsets[row] % 8;
+        scan[first] |= shiftedByte(stream.data(), stream.byteCount(), 0, shift);
+        if (last > first)
+            scan[last] |= shiftedByte(stream.data(), stream.byteCount(), last - first, shift);
+    }
+
+    // padding of the last byte with ones and byte stuffing, like the sequential writer does on flush
+    if (total_bits % 8 != 0)
+        scan.back() |= static_cast<uint8_t>((1U << (8 - total_bits % 8)) - 1);
+
+    useScanParts(1);
+    scan_parts[0].writeBytes(scan.data(), scan.size());
+}
+
+void Encoder::encodeComponentScans(const CodeTable &Y_DC,
+                                   const CodeTable &Y_AC,
+                                   const CodeTable &C_DC,
+                                   const CodeTable &C_AC,
+                                   uint restart_interval)
+{
+    const Plane<int>* components[] = { &QY, &QCb, &QCr };
+    uint widths[3], heights[3];
+    componentSizes(widths, heights);
+    const CodeTable* dc_tables[] = { &Y_DC, &C_DC, &C_DC };
+    const CodeTable* ac_tables[] = { &Y_AC, &C_AC, &C_AC };
+
+    // the components don't share anything, every one is a scan of its own
+    useScanParts(3);
+
+#pragma omp parallel for
+    for (int c = 0; c < 3; ++c) {
+        auto& stream = scan_parts[c];
+        int previous_dc = 0;
+
+        forEachComponentBlock(*components[c], widths[c], heights[c], [&](uint index, const int* block, size_t stride) {
+            if (restart_interval > 0 && index > 0 && index % restart_interval == 0) {
+                stream.flush();
+                stream.writeMarker(static_cast<uint8_t>(0xD0 + (index / restart_interval - 1) % 8)); // RST0 to RST7
+                previous_dc = 0;
+            }
+            encodeBlock(block, stride, previous_dc, *dc_tables[c], *ac_tables[c], stream);
+        });
+
+        stream.flush();
+    }
+}
+
+//
+// JPEG SEGMENTS
+//
+void Encoder::encode(const Image& image, OutputSink& sink, const EncoderOptions& options)
+{
+    // before anything is written
+    checkEncoderOptions(image, options);
+    ThreadCount thread_count(options.threads);
+
+    transform(image, options.subsampling, options.dct_mode);
+
+    if (options.target_size > 0) {
+        encodeWithinSize(sink, options);
+    }
+    else {
+        useQuality(options.quantization_y, options.quantization_c, options.quality);
+        quantize();
+        writeImage(sink, options);
+        last_quality = options.quality;
+    }
+
+    sink.finish();
+}
+
+void Encoder::writeImage(OutputSink& sink, const EncoderOptions& options)
+{
+    if (options.scan_script)
+        writeProgressive(sink, *options.scan_script);
+    else
+        writeBaseline(sink, options.huffman_mode, options.table_profile, options.restart_interval, options.interleaved);
+
+    sink << Segment::sEOI();
+}
+
+//
+// RATE CONTROL
+//
+
+size_t Encoder::estimateSize(const EncoderOptions& options, int quality)
+{
+    // like in the Sampled mode the symbols of every 4th MCU row count for the rest too (every 2nd or every row
+    // of smaller images, at least 16 are sampled). the interleaved baseline scan stands in for the others,
+    // progressive ones are usually a bit smaller
+    const uint mcu_row_step = std::max(1U, std::min(4U, mcus_y / 16));
+    const uint sampled_rows = (mcus_y + mcu_row_step - 1) / mcu_row_step;
+    const bool interleaved = options.interleaved || options.scan_script;
+    const uint restart_interval = options.scan_script ? 0 : options.restart_interval;
+
+    useQuality(options.quantization_y, options.quantization_c, quality);
+    quantize(mcu_row_step);
+    collectSampledStatistics(mcu_row_step, restart_interval);
+
+    // the codes writeBaseline uses, the optimized ones for the statistics of all blocks in the other modes
+    const CodeTable* codes[4];
+    const SymbolHistogram* histograms[] = { &HistogramY_DC, &HistogramY_AC, &HistogramC_DC, &HistogramC_AC };
+    if (options.huffman_mode == Image::Standard && !options.scan_script) {
+        codes[0] = &standardCodeTable(StandardTable::LuminanceDC);
+        codes[1] = &standardCodeTable(StandardTable::LuminanceAC);
+        codes[2] = &standardCodeTable(StandardTable::ChrominanceDC);
+        codes[3] = &standardCodeTable(StandardTable::ChrominanceAC);
+    }
+    else if (options.huffman_mode == Image::Profile && !options.scan_script) {
+        useProfile(*options.table_profile);
+        for (int i = 0; i < 4; ++i)
+            codes[i] = &profile_codes[i];
+    }
+    else {
+        for (int i = 0; i < 4; ++i) {
+            generateHuffmanCode(*histograms[i], huffman_scratch, generated_codes[i], generated_tables[i]);
+            codes[i] = &generated_codes[i];
+        }
+    }
+
+    uint64_t scan_bits = 0;
+    size_t table_bytes = 0;
+    for (int i = 0; i < 4; ++i) {
+        scan_bits += encodedBits(*histograms[i], *codes[i]) * mcus_y / sampled_rows;
+
+        // DHT: marker, length, class and destination, 16 counts and the symbols
+        table_bytes += 2 + 2 + 1 + 16;
+        for (uint symbol = 0; symbol < 256; ++symbol)
+            table_bytes += codes[i]->length(static_cast<uint8_t>(symbol)) > 0;
+    }
+
+    // the scan with about one stuffed zero byte every 256 bytes, every restart interval ends with padding and a marker
+    size_t scan_bytes = (scan_bits + 7) / 8;
+    scan_bytes += scan_bytes / 256;
+    if (restart_interval > 0) {
+        // MCUs, or blocks of the non-interleaved scans
+        const size_t mcus = static_cast<size_t>(mcus_x) * mcus_y;
+        const size_t units = interleaved ? mcus : mcus * (luma_h * luma_v + 2);
+        scan_bytes += 6 + (units + restart_interval - 1) / restart_interval * 3;
+    }
+
+    const size_t header_bytes = quantization_sets[quantization_set].header.size() + 19 + table_bytes + (interleaved ? 14 : 30) + 2;
+    return header_bytes + scan_bytes;
+}
+
+int Encoder::chooseQuality(const EncoderOptions& options, size_t target_size, int highest_quality)
+{
+    if (estimateSize(options, highest_quality) <= target_size)
+        return highest_quality;
+
+    // the size grows with the quality: binary search for the highest one that fits
+    int low = 1, high = highest_quality - 1;
+    while (low < high) {
+        const int middle = (low + high + 1) / 2;
+        if (estimateSize(options, middle) <= target_size)
+            low = middle;
+        else
+            high = middle - 1;
+    }
+    return low;
+}
+
+void Encoder::encodeWithinSize(OutputSink& sink, const EncoderOptions& options)
+{
+    size_t target_size = options.target_size;
+    int quality = options.quality;
+
+    // the estimate misses the exact stuffing and padding (and the progressive scans completely). if the jpeg
+    // turns out too big, the search goes on below that quality with the target reduced by the excess
+    for (;;) {
+        quality = chooseQuality(options, target_size, quality);
+
+        useQuality(options.quantization_y, options.quantization_c, quality);
+        quantize();
+        sized_output.clear();
+        writeImage(sized_output, options);
+
+        if (sized_output.size() <= options.target_size || quality == 1)
+            break;
+        target_size = static_cast<size_t>(static_cast<double>(target_size) * options.target_size / sized_output.size());
+        --quality;
+    }
+
+    last_quality = quality;
+    sink.write(sized_output.data().data(), sized_output.size());
+}
+
+void Encoder::writeHeaders(OutputSink& sink, bool progressive)
+{
+    const auto& header = quantization_sets[quantization_set].header;
+    sink.write(header.data().data(), header.size());
+
+    // the sampling factors of Y are horizontal in the high nibble and vertical in the low one
+    using namespace Segment;
+    const auto luma_sampling = static_cast<ComponentSetup::Subsampling>((luma_h << 4) | luma_v);
+    sink << sSOF0()
+        .setProgressive(progressive)
+        .setImageSizeX(real_width)
+        .setImageSizeY(real_height)
+        .setupY(luma_sampling, ComponentSetup::QuantizationTableID::Zero)
+        .setupCb(ComponentSetup::Half, ComponentSetup::QuantizationTableID::One)
+        .setupCr(ComponentSetup::Half, ComponentSetup::QuantizationTableID::One);
+}
+
+// the DHT segments of the Y DC, Y AC, C DC and C AC tables
+template <typename Output>
+static void writeTables(Output& out, const SymbolsPerLength& Y_DC, const SymbolsPerLength& Y_AC, const SymbolsPerLength& C_DC, const SymbolsPerLength& C_AC)
+{
+    using namespace Segment;
+    out << sDHT().pushCodeData(Y_DC, sDHT::DC, sDHT::First)
+        << sDHT().pushCodeData(Y_AC, sDHT::AC, sDHT::First)
+        << sDHT().pushCodeData(C_DC, sDHT::DC, sDHT::Second)
+        << sDHT().pushCodeData(C_AC, sDHT::AC, sDHT::Second);
+}
+
+void Encoder::useProfile(const TableProfile& table_profile)
+{
+    const SymbolsPerLength* tables[] = { &table_profile.Y_DC, &table_profile.Y_AC, &table_profile.C_DC, &table_profile.C_AC };
+
+    bool cached = table_header_mode == Image::Profile;
+    for (int i = 0; i < 4; ++i)
+        cached = cached && *tables[i] == profile_tables[i];
+    if (cached)
+        return;
+
+    for (int i = 0; i < 4; ++i) {
+        profile_tables[i] = *tables[i];
+        profile_codes[i] = generateCodeTable(profile_tables[i]);
+    }
+    table_header.clear();
+    writeTables(table_header, profile_tables[0], profile_tables[1], profile_tables[2], profile_tables[3]);
+    table_header_mode = Image::Profile;
+}
+
+void Encoder::writeBaseline(OutputSink& sink, Image::HuffmanMode huffman_mode, const TableProfile* table_profile, uint restart_interval, bool interleaved)
+{
+    // the fixed tables (and their DHT segments) are kept for the next image, the others are generated every time
+    const CodeTable *Y_DC_encoder, *Y_AC_encoder, *C_DC_encoder, *C_AC_encoder;
+
+    if (huffman_mode == Image::Standard) {
+        Y_DC_encoder = &standardCodeTable(StandardTable::LuminanceDC);
+        Y_AC_encoder = &standardCodeTable(StandardTable::LuminanceAC);
+        C_DC_encoder = &standardCodeTable(StandardTable::ChrominanceDC);
+        C_AC_encoder = &standardCodeTable(StandardTable::ChrominanceAC);
+
+        if (table_header_mode != Image::Standard) {
+            table_header.clear();
+            writeTables(table_header,
+                        standardSymbolsPerLength(StandardTable::LuminanceDC),
+                        standardSymbolsPerLength(StandardTable::LuminanceAC),
+                        standardSymbolsPerLength(StandardTable::ChrominanceDC),
+                        standardSymbolsPerLength(StandardTable::ChrominanceAC));
+            table_header_mode = Image::Standard;
+        }
+    }
+    else if (huffman_mode == Image::Profile) {
+        assert(table_profile);
+        useProfile(*table_profile);
+
+        Y_DC_encoder = &profile_codes[0];
+        Y_AC_encoder = &profile_codes[1];
+        C_DC_encoder = &profile_codes[2];
+        C_AC_encoder = &profile_codes[3];
+    }
+    else {
+        if (huffman_mode == Image::Optimized) {
+            // the statistics of all blocks (with the DC predictions reset at the restart markers)
+            if (interleaved)
+                collectSampledStatistics(1, restart_interval);
+            else
+                collectComponentStatistics(restart_interval);
+        }
+        else {
+            assert(huffman_mode == Image::Sampled);
+
+            // statistics from every 4th MCU row, the symbols of the other rows need a code too
+            // (the DC differences of non-interleaved scans are different ones, but every DC symbol is reserved anyway)
+            collectSampledStatistics(4, restart_interval);
+            reserveDCSymbols(HistogramY_DC);
+            reserveACSymbols(HistogramY_AC);
+            reserveDCSymbols(HistogramC_DC);
+            reserveACSymbols(HistogramC_AC);
+        }
+
+        const SymbolHistogram* histograms[] = { &HistogramY_DC, &HistogramY_AC, &HistogramC_DC, &HistogramC_AC };
+        for (int i = 0; i < 4; ++i)
+            generateHuffmanCode(*histograms[i], huffman_scratch, generated_codes[i], generated_tables[i]);
+
+        Y_DC_encoder = &generated_codes[0];
+        Y_AC_encoder = &generated_codes[1];
+        C_DC_encoder = &generated_codes[2];
+        C_AC_encoder = &generated_codes[3];
+    }
+
+    // the tables are known, so DC differences, RLE, category and huffman coding are done in one go
+    if (interleaved)
+        encodeScan(*Y_DC_encoder, *Y_AC_encoder, *C_DC_encoder, *C_AC_encoder, restart_interval);
+    else
+        encodeComponentScans(*Y_DC_encoder, *Y_AC_encoder, *C_DC_encoder, *C_AC_encoder, restart_interval);
+
+    writeHeaders(sink, false);
+
+    using namespace Segment;
+    if (huffman_mode == Image::Standard || huffman_mode == Image::Profile)
+        sink.write(table_header.data().data(), table_header.size());
+    else {
+        // the same segments as writeTables, filled into the ones kept from the image before
+        for (int i = 0; i < 4; ++i) {
+            sink << generated_segments[i].setCodeData(generated_tables[i], i % 2 == 0 ? sDHT::DC : sDHT::AC,
+                                                      i < 2 ? sDHT::First : sDHT::Second);
+        }
+    }
+
+    if (restart_interval > 0)
+        sink << sDRI().setRestartInterval(static_cast<short>(restart_interval));
+
+    if (interleaved) {
+        sink << sSOS()
+                .setupY (sDHT::First, sDHT::First) // DC, AC
+                .setupCb(sDHT::Second, sDHT::Second)
+                .setupCr(sDHT::Second, sDHT::Second);
+
+        // the restart intervals with the RSTn markers in between
+        for (auto i = 0U; i < scan_part_count; ++i) {
+            if (i > 0) {
+                const uint8_t marker[] = { 0xFF, static_cast<uint8_t>(0xD0 + (i - 1) % 8) }; // RST0 to RST7
+                sink.write(marker, sizeof(marker));
+            }
+            sink.write(scan_parts[i].data(), scan_parts[i].byteCount());
+        }
+    }
+    else {
+        const ComponentSetup::ID components[] = { ComponentSetup::Y, ComponentSetup::Cb, ComponentSetup::Cr };
+        for (auto c = 0U; c < 3; ++c) {
+            auto tables = c == 0 ? sDHT::First : sDHT::Second;
+            sink << sSOS().setupSingle(components[c], tables, tables);
+            sink.write(scan_parts[c].data(), scan_parts[c].byteCount());
+        }
+    }
+}
+
+void Encoder::writeProgressive(OutputSink& sink, const ScanScript& scan_script)
+{
+    writeHeaders(sink, true);
+
+    // Y has luma_h x luma_v blocks in every MCU, chroma one
+    uint widths[3], heights[3];
+    componentSizes(widths, heights);
+    const ProgressiveComponent components[3] = {
+        { QY.data(),  QY.stride(),  widths[0], heights[0], luma_h, luma_v },
+        { QCb.data(), QCb.stride(), widths[1], heights[1], 1, 1 },
+        { QCr.data(), QCr.stride(), widths[2], heights[2], 1, 1 },
+    };
+    useScanParts(1);
+    writeProgressiveScans(sink, components, mcus_x, mcus_y, scan_script, scan_parts[0]);
+}
@@ -1,5 +1,22 @@
 #include "Huffman.hpp"
 
+// list of symbols grouped by code length (symbols[code_length]), max code length is 16
+static void codeLengthsFromFrequencies(vector<Symbol>& symbol_frequency, HuffmanScratch& scratch, SymbolsPerLength& symbols) {
+    assert(symbol_frequency.size() > 0);
+
+    // special case when we only have one type of symbol
+    if (symbol_frequency.size() == 1) {
+        symbols.resize(17);
+        for (auto& symbol_list : symbols)
+            symbol_list.clear();
+        symbols[1].push_back(symbol_frequency[0].symbol);
+        return;
+    }
+
+    package_merge(symbol_frequency, 15, scratch, symbols);
+    preventOnlyOnesCode(symbols);
+}
+
 pair<SymbolCodeMap, SymbolsPerLength> generateHuffmanCode(std::vector<int> text) {
     assert(text.size() > 0);
 
@@ -13,25 +30,65 @@ pair<SymbolCodeMap, SymbolsPerLength> generateHuffmanCode(std::vector<int> text)
         symbol_frequency.push_back(Symbol(it->first,  it->second));
     }
 
-    // special case when we only have one type of symbol
-    if (symbol_counts.size() == 1) {
-        SymbolCodeMap code_map;
-        code_map.emplace(text[0], Code(Bitstream({ 0 })));
+    HuffmanScratch scratch;
+    SymbolsPerLength symbols;
+    codeLengthsFromFrequencies(symbol_frequency, scratch, symbols);
+    return std::make_pair(generateCodes(symbols), symbols);
+}
 
-        SymbolsPerLength symbols(17);
-        symbols[1] = { text[0] };
+pair<CodeTable, SymbolsPerLength> generateHuffmanCode(const SymbolHistogram& histogram) {
+    HuffmanScratch scratch;
+    pair<CodeTable, SymbolsPerLength> code;
+    generateHuffmanCode(histogram, scratch, code.first, code.second);
+    return code;
+}
 
-        return std::make_pair(code_map, symbols);
+void generateHuffmanCode(const SymbolHistogram& histogram, HuffmanScratch& scratch, CodeTable& code_table, SymbolsPerLength& symbols) {
+    // room for all byte symbols (and the 15 levels of package_merge), so the vectors never grow again
+    scratch.symbols.reserve(256);
+    scratch.is_package.reserve(15 * 2 * 256);
+    scratch.level_size.reserve(15);
+    scratch.weights.reserve(2 * 256);
+    scratch.next_weights.reserve(2 * 256);
+    scratch.code_lengths.reserve(256);
+    symbols.resize(17);
+    for (auto& symbol_list : symbols)
+        symbol_list.reserve(256);
+
+    scratch.symbols.clear();
+    for (auto symbol = 0U; symbol < histogram.size(); ++symbol) {
+        if (histogram[symbol] > 0)
+            scratch.symbols.push_back(Symbol(symbol, histogram[symbol]));
     }
 
-    // list of symbols grouped by code length
-    // symbols_for_length = symbols[code_length]
-    SymbolsPerLength symbols = package_merge(symbol_frequency, 15);
-    preventOnlyOnesCode(symbols);
+    codeLengthsFromFrequencies(scratch.symbols, scratch, symbols);
+    code_table = generateCodeTable(symbols);
+}
+
+uint64_t encodedBits(const SymbolHistogram& histogram, const CodeTable& table)
+{
+    uint64_t bits = 0;
+    for (uint32_t symbol = 0; symbol < 256; ++symbol) {
+        assert(histogram[symbol] == 0 || table.length(static_cast<uint8_t>(symbol)) > 0);
+        bits += static_cast<uint64_t>(histogram[symbol]) * (table.length(static_cast<uint8_t>(symbol)) + (symbol & 0x0F));
+    }
+    return bits;
+}
 
-    SymbolCodeMap code_map = generateCodes(symbols);
+void reserveDCSymbols(SymbolHistogram& histogram) {
+    for (int category = 0; category <= 11; ++category)
+        histogram[category] = std::max(histogram[category], 1U);
+}
 
-    return std::make_pair(code_map, symbols);
+void reserveACSymbols(SymbolHistogram& histogram) {
+    histogram[0x00] = std::max(histogram[0x00], 1U); // EOB
+    histogram[0xF0] = std::max(histogram[0xF0], 1U); // ZRL
+    for (int run = 0; run < 16; ++run) {
+        for (int category = 1; category <= 10; ++category) {
+            auto symbol = (run << 4) | category;
+            histogram[symbol] = std::max(histogram[symbol], 1U);
+        }
+    }
 }
 
 void preventOnlyOnesCode(SymbolsPerLength& symbols) {
@@ -65,83 +122,187 @@ SymbolCodeMap generateCodes(const SymbolsPerLength& symbols) {
     return code_map;
 }
 
+CodeTable generateCodeTable(const SymbolsPerLength& symbols) {
+    // same canonical codes as generateCodes
+    CodeTable code_table;
 
-Bitstream huffmanEncode(vector<int> text, SymbolCodeMap code_map) {
-    Bitstream result;
-    for (auto symbol : text) {
-        const Code& code = code_map[symbol];
-        result.push_back(code.code, code.length);
+    uint32_t code = 0;
+    for (size_t length = 1; length < symbols.size(); length++) {
+        for (int symbol : symbols[length]) {
+            assert(symbol >= 0 && symbol < 256);
+            code_table.set(static_cast<uint8_t>(symbol), code, static_cast<uint8_t>(length));
+            ++code;
+        }
+        code <<= 1;
     }
-    return result;
-}
 
-// fill everything to the right of the code with 1s
-uint32_t fillRestWithOnes(uint32_t code, uint8_t code_length) {
-    return code | ((1 << (32 - code_length)) - 1);
+    return code_table;
 }
 
 
-DecodeEntry::DecodeEntry(uint32_t code, uint8_t code_length, int symbol) {
-    this->symbol = symbol;
-    this->code_length = code_length;
-    this->code = fillRestWithOnes(code, code_length);
+// Annex K.3: number of codes per code length 1..16 followed by the symbols in code order
+static const uint8_t luminance_dc_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t luminance_dc_values[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t chrominance_dc_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t chrominance_dc_values[] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+
+static const uint8_t luminance_ac_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t luminance_ac_values[] = {
+    0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+    0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+    0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+    0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+    0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+    0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+    0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+    0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+    0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+    0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static const uint8_t chrominance_ac_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t chrominance_ac_values[] = {
+    0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+    0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+    0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+    0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+    0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+    0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+    0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+    0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+    0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+    0xf9, 0xfa
+};
+
+static SymbolsPerLength symbolsFromTable(const uint8_t bits[16], const uint8_t* values) {
+    SymbolsPerLength symbols(17);
+    for (int length = 1; length <= 16; ++length) {
+        symbols[length].assign(values, values + bits[length - 1]);
+        values += bits[length - 1];
+    }
+    return symbols;
 }
 
+// built once at startup, afterwards they are only read
+static const SymbolsPerLength standard_symbols[] = {
+    symbolsFromTable(luminance_dc_bits, luminance_dc_values),
+    symbolsFromTable(luminance_ac_bits, luminance_ac_values),
+    symbolsFromTable(chrominance_dc_bits, chrominance_dc_values),
+    symbolsFromTable(chrominance_ac_bits, chrominance_ac_values)
+};
+
+static const CodeTable standard_code_tables[] = {
+    generateCodeTable(standard_symbols[0]),
+    generateCodeTable(standard_symbols[1]),
+    generateCodeTable(standard_symbols[2]),
+    generateCodeTable(standard_symbols[3])
+};
+
+const SymbolsPerLength& standardSymbolsPerLength(StandardTable table) {
+    return standard_symbols[static_cast<int>(table)];
+}
 
-vector<int> huffmanDecode(Bitstream bitstream, SymbolCodeMap code_map) {
-    vector<DecodeEntry> code_table;
-    code_table.reserve(code_map.size());
-
-    uint8_t max_code_length = 0;
-
-    // prepare code_table and calc max_code_length
-    for (const std::pair<int, Code>& pair : code_map) {
-        uint8_t code_length = pair.second.length;
-        if (code_length > max_code_length)
-            max_code_length = code_length;
+const CodeTable& standardCodeTable(StandardTable table) {
+    return standard_code_tables[static_cast<int>(table)];
+}
 
-        code_table.emplace_back(pair.second.code, code_length, pair.first);
+Bitstream huffmanEncode(const vector<int>& text, const SymbolCodeMap& code_map) {
+    Bitstream result;
+    for (auto symbol : text) {
+        const Code& code = code_map.at(symbol);
+        result.push_back(code.code, code.length);
     }
-    assert(max_code_length <= 32);
-
-    // sort accoring to code
-    std::sort(code_table.begin(), code_table.end());
+    return result;
+}
 
+Bitstream huffmanEncode(const vector<uint8_t>& text, const CodeTable& code_table) {
+    Bitstream result;
+    for (auto symbol : text) {
+        assert(code_table.length(symbol) > 0);
+        result.push_back_LSB_mode(code_table.code(symbol), code_table.length(symbol));
+    }
+    return result;
+}
 
-    vector<int> decoded_text;
-    uint8_t to_extract = max_code_length;
-
-    // current pos in bitstream
-    unsigned int pos = 0;
-
-    while (pos < bitstream.size()) {
-        // when we are at the end, we have to extract less
-        if (pos + max_code_length >= bitstream.size())
-            to_extract = bitstream.size() - pos;
-
-        uint32_t bits = bitstream.extract(to_extract, pos);
-        bits = fillRestWithOnes(bits, max_code_length);
-
-        // find matching symbol for extracted code
-        // todo: binary search
-        // linear search for now...
-        int index = -1;
-        for (int i = 0; i < code_table.size(); i++) {
-            // first entry that is greater than the extracted bits
-            if (code_table[i].code >= bits) {
-                index = i;
-                break;
+HuffmanDecoder::HuffmanDecoder(const SymbolsPerLength& symbols) {
+    assert(symbols.size() <= 17);
+
+    for (auto& entry : lookup)
+        entry = Entry{ 0, 0 };
+
+    int code = 0;
+    for (int length = 1; length <= 16; ++length) {
+        value_offset[length] = static_cast<int>(values.size()) - code;
+        max_code[length] = -1;
+
+        if (length < static_cast<int>(symbols.size())) {
+            for (int symbol : symbols[length]) {
+                if (length <= lookahead_bits) {
+                    // every lookahead value starting with this code
+                    auto shift = lookahead_bits - length;
+                    for (int fill = 0; fill < (1 << shift); ++fill)
+                        lookup[(code << shift) | fill] = Entry{ symbol, static_cast<uint8_t>(length) };
+                }
+
+                values.push_back(symbol);
+                max_code[length] = code;
+                ++code;
             }
         }
-        // no entry found
-        // some better error handling?
-        assert(index != -1);
+        code <<= 1;
+    }
+}
 
-        decoded_text.push_back(code_table[index].symbol);
+HuffmanDecoder::Entry HuffmanDecoder::decodeLong(uint32_t bits) const {
+    for (int length = lookahead_bits + 1; length <= 16; ++length) {
+        int code = bits >> (16 - length);
+        if (code <= max_code[length])
+            return Entry{ values[code + value_offset[length]], static_cast<uint8_t>(length) };
+    }
+    return Entry{ 0, 0 };
+}
 
-        // next position to extract from
-        pos += code_table[index].code_length;
+vector<int> huffmanDecode(const Bitstream& bitstream, const SymbolsPerLength& symbols) {
+    HuffmanDecoder decoder(symbols);
+    vector<int> decoded_text;
+    // rough guess: most codes are shorter than 8 bits
+    decoded_text.reserve(bitstream.size() / 4);
+
+    auto bytes = bitstream.bytes();
+    BitReader reader(bytes.data(), bytes.size());
+
+    while (reader.position() < bitstream.size()) {
+        // behind the end the reader fills up with 1s, which never is a complete code
+        auto entry = decoder.decode(reader.peek(16));
+        // no matching code, some better error handling?
+        assert(entry.length > 0);
+        if (entry.length == 0)
+            break;
+
+        decoded_text.push_back(entry.symbol);
+        reader.skip(entry.length);
     }
 
     return decoded_text;
-}
\ No newline at end of file
+}
+
+vector<int> huffmanDecode(const Bitstream& bitstream, const SymbolCodeMap& code_map) {
+    // canonical codes: sorting by length and code gives the symbol lists of the DHT segment
+    vector<pair<Code, int>> codes;
+    for (auto& entry : code_map)
+        codes.emplace_back(entry.second, entry.first);
+    std::sort(begin(codes), end(codes), [](const pair<Code, int>& a, const pair<Code, int>& b) {
+        return a.first.length < b.first.length || (a.first.length == b.first.length && a.first.code < b.first.code);
+    });
+
+    SymbolsPerLength symbols(17);
+    for (auto& code : codes) {
+        assert(code.first.length <= 16);
+        symbols[code.first.length].push_back(code.second);
+    }
+
+    return huffmanDecode(bitstream, symbols);
+}
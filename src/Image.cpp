@@ -5,6 +5,7 @@
 #include <streambuf>
 #include <sstream>
 #include <future>
+#include <tuple>
 #include <omp.h>
 #include <future>
 
@@ -13,6 +14,7 @@
 #include <boost/numeric/ublas/io.hpp>
 
 #include "JpegSegments.hpp"
+#include "Encoder.hpp"
 #include "Dct.hpp"
 
 using boost::numeric::ublas::matrix_range;
@@ -122,25 +124,9 @@ Image Image::convertToColorSpace(ColorSpace target_color_space) const {
             {
                 assert(color_space_type == ColorSpace::RGB);
 
-                // matrix factors
-                /*
-                  0.299  0.587  0.114
-                 -0.169 -0.331  0.500
-                  0.500 -0.419 -0.081
-                 */
-                static const float Flat[] { .0f, 256/2.f, 256/2.f };
-                static const float Yv[] {  .299f,   .587f,   .114f };
-                static const float Cb[] { -.1687f, -.3312f,  .5f };
-                static const float Cr[] {  .5f,    -.4186f, -.0813f };
-
                 for (uint x = 0; x < num_pixel; ++x) {
-                    auto& r = R.data()[x];
-                    auto& g = G.data()[x];
-                    auto& b = B.data()[x];
-
-                    converted.Y.data()[x]  = Flat[0] + (Yv[0] * r + Yv[1] * g + Yv[2] * b) - 128;
-                    converted.Cb.data()[x] = Flat[1] + (Cb[0] * r + Cb[1] * g + Cb[2] * b) - 128;
-                    converted.Cr.data()[x] = Flat[2] + (Cr[0] * r + Cr[1] * g + Cr[2] * b) - 128;
+                    convertPixelToYCbCr(R.data()[x], G.data()[x], B.data()[x],
+                                        converted.Y.data()[x], converted.Cb.data()[x], converted.Cr.data()[x]);
                 }
 
                 converted.color_space_type = ColorSpace::YCbCr;
@@ -537,6 +523,85 @@ Image loadPPM(std::string path) {
     return img;
 }
 
+//
+// YUV loading
+//
+
+// image in YCbCr with 4:2:0 chroma planes, padded to 16x16 blocks like the ppm images
+static Image allocateYUV420Image(uint width, uint height) {
+    auto padded_width = width + (16 - width % 16) % 16;
+    auto padded_height = height + (16 - height % 16) % 16;
+
+    Image img(padded_width, padded_height, Image::YCbCr);
+    img.real_width = width;
+    img.real_height = height;
+    img.subsample_width = padded_width / 2;
+    img.subsample_height = padded_height / 2;
+    img.Cb.resize(img.subsample_height, img.subsample_width, false);
+    img.Cr.resize(img.subsample_height, img.subsample_width, false);
+
+    return img;
+}
+
+// copy a plane and fill the padding with data from the border, sample_fn(x, y) returns the unshifted sample
+template <typename SampleFn>
+static void fillPlane(matrix<PixelDataType>& plane, uint width, uint height, SampleFn sample_fn) {
+    for (auto y = 0U; y < plane.size1(); ++y) {
+        auto src_y = std::min(y, height - 1);
+        for (auto x = 0U; x < plane.size2(); ++x) {
+            auto src_x = std::min(x, width - 1);
+            plane(y, x) = sample_fn(src_x, src_y) - 128.;
+        }
+    }
+}
+
+Image loadI420(const Byte* y, uint y_stride, const Byte* u, uint u_stride, const Byte* v, uint v_stride, uint width, uint height) {
+    assert(width > 0 && height > 0);
+    auto img = allocateYUV420Image(width, height);
+    const auto chroma_width = (width + 1) / 2;
+    const auto chroma_height = (height + 1) / 2;
+
+    fillPlane(img.Y, width, height, [&](uint x, uint row) { return y[row * y_stride + x]; });
+    fillPlane(img.Cb, chroma_width, chroma_height, [&](uint x, uint row) { return u[row * u_stride + x]; });
+    fillPlane(img.Cr, chroma_width, chroma_height, [&](uint x, uint row) { return v[row * v_stride + x]; });
+
+    return img;
+}
+
+Image loadNV12(const Byte* y, uint y_stride, const Byte* uv, uint uv_stride, uint width, uint height) {
+    assert(width > 0 && height > 0);
+    auto img = allocateYUV420Image(width, height);
+    const auto chroma_width = (width + 1) / 2;
+    const auto chroma_height = (height + 1) / 2;
+
+    fillPlane(img.Y, width, height, [&](uint x, uint row) { return y[row * y_stride + x]; });
+    fillPlane(img.Cb, chroma_width, chroma_height, [&](uint x, uint row) { return uv[row * uv_stride + 2 * x]; });
+    fillPlane(img.Cr, chroma_width, chroma_height, [&](uint x, uint row) { return uv[row * uv_stride + 2 * x + 1]; });
+
+    return img;
+}
+
+Image loadYUYV(const Byte* yuyv, uint stride, uint width, uint height) {
+    assert(width > 0 && height > 0);
+    assert((width % 2 == 0) && "YUYV needs an even width");
+    auto img = allocateYUV420Image(width, height);
+    const auto chroma_width = (width + 1) / 2;
+    const auto chroma_height = (height + 1) / 2;
+
+    // Y0 U Y1 V, one U/V pair for every two pixels of a row
+    fillPlane(img.Y, width, height, [&](uint x, uint row) { return yuyv[row * stride + 2 * x]; });
+
+    // average two rows to go from 4:2:2 to 4:2:0 (like S420_lm), the last row of an odd height image is used twice
+    auto chroma = [&](uint x, uint row, uint offset) {
+        auto row1 = std::min(2 * row + 1, height - 1);
+        return (yuyv[2 * row * stride + 4 * x + offset] + yuyv[row1 * stride + 4 * x + offset]) / 2.;
+    };
+    fillPlane(img.Cb, chroma_width, chroma_height, [&](uint x, uint row) { return chroma(x, row, 1); });
+    fillPlane(img.Cr, chroma_width, chroma_height, [&](uint x, uint row) { return chroma(x, row, 3); });
+
+    return img;
+}
+
 void Image::applyDCT(DCTMode mode) 
 {
     std::function<void(const matrix_range<matrix<PixelDataType>>&, matrix_range<matrix<PixelDataType>>&)> dctFn;
@@ -549,7 +614,7 @@ void Image::applyDCT(DCTMode mode)
         dctFn = dctMat;
         break;
     case Arai:
-        dctFn = dctArai;
+        dctFn = [](const matrix_range<matrix<PixelDataType>>& x, matrix_range<matrix<PixelDataType>>& y) { dctArai(x, y); };
         break;
     default:
         assert(!"This DCT mode isn't supported!");
@@ -692,10 +757,7 @@ void Image::doRLEandCategoryCoding() {
     auto f1 = std::async([&]() {
         for (int h = 0; h < height; h += blocksize) {
             for (int w = 0; w < width; w += blocksize) {
-                // generate slices for the data source
-                const auto slice_src = subrange(QY, h, h + blocksize, w, w + blocksize);
-
-                auto rle_data = RLE_AC(slice_src);
+                auto rle_data = RLE_AC(&QY(h, w), QY.size2());
                 auto encoded_coeffs = encode_category(rle_data);
                 CategoryCodeY(h / blocksize, w / blocksize) = encoded_coeffs;
             }
@@ -705,10 +767,7 @@ void Image::doRLEandCategoryCoding() {
     auto f2 = std::async([&]() {
         for (int h = 0; h < subsample_height; h += blocksize) {
             for (int w = 0; w < subsample_width; w += blocksize) {
-                // generate slices for the data source
-                const auto slice_src = subrange(QCb, h, h + blocksize, w, w + blocksize);
-
-                auto rle_data = RLE_AC(slice_src);
+                auto rle_data = RLE_AC(&QCb(h, w), QCb.size2());
                 auto encoded_coeffs = encode_category(rle_data);
                 CategoryCodeCb(h / blocksize, w / blocksize) = encoded_coeffs;
             }
@@ -718,10 +777,7 @@ void Image::doRLEandCategoryCoding() {
     auto f3 = std::async([&]() {
         for (int h = 0; h < subsample_height; h += blocksize) {
             for (int w = 0; w < subsample_width; w += blocksize) {
-                // generate slices for the data source
-                const auto slice_src = subrange(QCr, h, h + blocksize, w, w + blocksize);
-
-                auto rle_data = RLE_AC(slice_src);
+                auto rle_data = RLE_AC(&QCr(h, w), QCr.size2());
                 auto encoded_coeffs = encode_category(rle_data);
                 CategoryCodeCr(h / blocksize, w / blocksize) = encoded_coeffs;
             }
@@ -734,10 +790,10 @@ void Image::doRLEandCategoryCoding() {
     f3.get();
 }
 
-void Image::doHuffmanEncoding(SymbolCodeMap &Y_DC,
-                              SymbolCodeMap &Y_AC,
-                              SymbolCodeMap &C_DC,
-                              SymbolCodeMap &C_AC)
+void Image::doHuffmanEncoding(const CodeTable &Y_DC,
+                              const CodeTable &Y_AC,
+                              const CodeTable &C_DC,
+                              const CodeTable &C_AC)
 {
 
     // the data in the BitstreamXX vectors must be sequential correct (left to right, then top to bottom),
@@ -754,15 +810,13 @@ void Image::doHuffmanEncoding(SymbolCodeMap &Y_DC,
                 auto& data = CategoryCodeY(i, j);
                 auto& code = data[0];
 
-                auto encoded_DC = Y_DC[code.symbol];
-                stream.push_back(encoded_DC.code, encoded_DC.length);
-                stream << code.code;
+                stream.push_back_LSB_mode(Y_DC.code(code.symbol), Y_DC.length(code.symbol));
+                stream.push_back_LSB_mode(code.code, code.length());
 
                 for (auto it = begin(data) + 1; it != end(data); ++it) {
                     auto& code = *it;
-                    auto encoded_AC = Y_AC[code.symbol];
-                    stream.push_back(encoded_AC.code, encoded_AC.length);
-                    stream << code.code;
+                    stream.push_back_LSB_mode(Y_AC.code(code.symbol), Y_AC.length(code.symbol));
+                    stream.push_back_LSB_mode(code.code, code.length());
                 }
 
                 BitstreamY(i, j) = stream;
@@ -780,15 +834,13 @@ void Image::doHuffmanEncoding(SymbolCodeMap &Y_DC,
                 auto& data = CategoryCodeCb(i, j);
                 auto& code = data[0];
 
-                auto encoded_DC = C_DC[code.symbol];
-                stream.push_back(encoded_DC.code, encoded_DC.length);
-                stream << code.code;
+                stream.push_back_LSB_mode(C_DC.code(code.symbol), C_DC.length(code.symbol));
+                stream.push_back_LSB_mode(code.code, code.length());
 
                 for (auto it = begin(data) + 1; it != end(data); ++it) {
                     auto& code = *it;
-                    auto encoded_AC = C_AC[code.symbol];
-                    stream.push_back(encoded_AC.code, encoded_AC.length);
-                    stream << code.code;
+                    stream.push_back_LSB_mode(C_AC.code(code.symbol), C_AC.length(code.symbol));
+                    stream.push_back_LSB_mode(code.code, code.length());
                 }
 
                 BitstreamCb(i, j) = stream;
@@ -806,15 +858,13 @@ void Image::doHuffmanEncoding(SymbolCodeMap &Y_DC,
                 auto& data = CategoryCodeCr(i, j);
                 auto& code = data[0];
 
-                auto encoded_DC = C_DC[code.symbol];
-                stream.push_back(encoded_DC.code, encoded_DC.length);
-                stream << code.code;
+                stream.push_back_LSB_mode(C_DC.code(code.symbol), C_DC.length(code.symbol));
+                stream.push_back_LSB_mode(code.code, code.length());
 
                 for (auto it = begin(data) + 1; it != end(data); ++it) {
                     auto& code = *it;
-                    auto encoded_AC = C_AC[code.symbol];
-                    stream.push_back(encoded_AC.code, encoded_AC.length);
-                    stream << code.code;
+                    stream.push_back_LSB_mode(C_AC.code(code.symbol), C_AC.length(code.symbol));
+                    stream.push_back_LSB_mode(code.code, code.length());
                 }
 
                 BitstreamCr(i, j) = stream;
@@ -828,148 +878,56 @@ void Image::doHuffmanEncoding(SymbolCodeMap &Y_DC,
     f3.get();
 }
 
-void Image::writeJPEG(std::string file)
+SymbolStatistics Image::collectStatistics() const
 {
-    auto start = high_resolution_clock::now();
-
-    // printing some info
-    std::cout << "Processing image size: " << real_width << "x" << real_height << std::endl;
-
-    // color conversion to YCbCr
-    *this = convertToColorSpace(YCbCr);
-
-    // Cb/Cr subsampling
-    applySubsampling(SubsamplingMode::S420_m);
-
-    applyDCT(DCTMode::Arai);
-    Y  = zero_matrix<PixelDataType>(0, 0);
-    Cb = zero_matrix<PixelDataType>(0, 0);
-    Cr = zero_matrix<PixelDataType>(0, 0);
-
-    // quantization
-    const auto qtable_y = from_vector<int>({
-        16, 11, 10, 16, 24, 40, 51, 61,
-        12, 12, 14, 19, 26, 58, 60, 55,
-        14, 13, 16, 24, 40, 57, 69, 56,
-        14, 17, 22, 29, 51, 87, 80, 62,
-        18, 22, 37, 56, 68, 109, 103, 77,
-        24, 35, 55, 64, 81, 104, 113, 92,
-        49, 64, 78, 87, 103, 121, 120, 101,
-        72, 92, 95, 98, 112, 100, 103, 99
-    });
-    const auto qtable_c = from_vector<int>({
-        17, 18, 24, 47, 99, 99, 99, 99,
-        18, 21, 26, 66, 99, 99, 99, 99,
-        24, 26, 56, 99, 99, 99, 99, 99,
-        47, 66, 99, 99, 99, 99, 99, 99,
-        99, 99, 99, 99, 99, 99, 99, 99,
-        99, 99, 99, 99, 99, 99, 99, 99,
-        99, 99, 99, 99, 99, 99, 99, 99,
-        99, 99, 99, 99, 99, 99, 99, 99
-    });
-
-    applyQuantization(qtable_y, qtable_c);
+    Encoder encoder;
+    return encoder.collectStatistics(*this);
+}
 
-    DctY  = zero_matrix<PixelDataType>(0, 0);
-    DctCb = zero_matrix<PixelDataType>(0, 0);
-    DctCr = zero_matrix<PixelDataType>(0, 0);
+size_t maxEncodedSize(uint width, uint height)
+{
+    return maxEncodedSize(width, height, EncoderOptions());
+}
 
-    // DC difference coding
-    applyDCdifferenceCoding();
-    
-    // zigzag, RLE and category encoding
-    doRLEandCategoryCoding();
-
-    QY  = zero_matrix<int>(0, 0);
-    QCb = zero_matrix<int>(0, 0);
-    QCr = zero_matrix<int>(0, 0);
-
-    // generate Huffman tables
-    std::vector<int> Y_DC_symbols, Y_AC_symbols;
-    std::vector<int> C_DC_symbols, C_AC_symbols;
-
-    // count symbols
-    for (const auto& data : CategoryCodeY.data()) {
-        Y_DC_symbols.push_back(data[0].symbol);
-        for (auto it = begin(data) + 1; it != end(data); ++it)
-            Y_AC_symbols.push_back((*it).symbol);
-    }
-    for (const auto& data : CategoryCodeCb.data()) {
-        C_DC_symbols.push_back(data[0].symbol);
-        for (auto it = begin(data) + 1; it != end(data); ++it)
-            C_AC_symbols.push_back((*it).symbol);
-    }
-    for (const auto& data : CategoryCodeCr.data()) {
-        C_DC_symbols.push_back(data[0].symbol);
-        for (auto it = begin(data) + 1; it != end(data); ++it)
-            C_AC_symbols.push_back((*it).symbol);
-    }
+void Image::writeJPEG(std::string file, HuffmanMode huffman_mode, const TableProfile* table_profile, uint restart_interval, bool interleaved, const ScanScript* scan_script) const
+{
+    EncoderOptions options;
+    options.huffman_mode = huffman_mode;
+    options.table_profile = table_profile;
+    options.restart_interval = restart_interval;
+    options.interleaved = interleaved;
+    options.scan_script = scan_script;
+    writeJPEG(file, options);
+}
 
-    auto Y_DC_huff = generateHuffmanCode(Y_DC_symbols);
-    auto Y_AC_huff = generateHuffmanCode(Y_AC_symbols);
-
-    auto C_DC_huff = generateHuffmanCode(C_DC_symbols);
-    auto C_AC_huff = generateHuffmanCode(C_AC_symbols);
-
-    auto& Y_DC_encoder       = Y_DC_huff.first;
-    auto& Y_DC_Huffman_Table = Y_DC_huff.second;
-
-    auto& Y_AC_encoder       = Y_AC_huff.first;
-    auto& Y_AC_Huffman_Table = Y_AC_huff.second;
-
-    auto& C_DC_encoder       = C_DC_huff.first;
-    auto& C_DC_Huffman_Table = C_DC_huff.second;
-
-    auto& C_AC_encoder       = C_AC_huff.first;
-    auto& C_AC_Huffman_Table = C_AC_huff.second;
-
-    // Huffman encode symbols
-    doHuffmanEncoding(Y_DC_encoder, Y_AC_encoder, C_DC_encoder, C_AC_encoder);
-
-    // jpeg needs zigzag sorted quantization table
-    auto zigzag_qtable_y = zigzag<Byte>(qtable_y);
-    auto zigzag_qtable_c = zigzag<Byte>(qtable_c);
-
-    std::ofstream jpeg(file, std::ios::binary);
-
-    using namespace Segment;
-    jpeg << sSOI()
-        << sAPP0()
-        << sDQT().pushQuantizationTable(zigzag_qtable_y, ComponentSetup::QuantizationTableID::Zero)
-        << sDQT().pushQuantizationTable(zigzag_qtable_c, ComponentSetup::QuantizationTableID::One)
-        << sSOF0()
-            .setImageSizeX(real_width)
-            .setImageSizeY(real_height)
-            .setupY(ComponentSetup::NoSubSampling, ComponentSetup::QuantizationTableID::Zero)
-            .setupCb(ComponentSetup::Half, ComponentSetup::QuantizationTableID::One)
-            .setupCr(ComponentSetup::Half, ComponentSetup::QuantizationTableID::One)
-        << sDHT().pushCodeData(Y_DC_Huffman_Table, sDHT::DC, sDHT::First)
-        << sDHT().pushCodeData(Y_AC_Huffman_Table, sDHT::AC, sDHT::First)
-        << sDHT().pushCodeData(C_DC_Huffman_Table, sDHT::DC, sDHT::Second)
-        << sDHT().pushCodeData(C_AC_Huffman_Table, sDHT::AC, sDHT::Second)
-        << sSOS()
-            .setupY (sDHT::First, sDHT::First) // DC, AC
-            .setupCb(sDHT::Second, sDHT::Second)
-            .setupCr(sDHT::Second, sDHT::Second)
-        ;
+void Image::writeJPEG(OutputSink& sink, HuffmanMode huffman_mode, const TableProfile* table_profile, uint restart_interval, bool interleaved, const ScanScript* scan_script) const
+{
+    EncoderOptions options;
+    options.huffman_mode = huffman_mode;
+    options.table_profile = table_profile;
+    options.restart_interval = restart_interval;
+    options.interleaved = interleaved;
+    options.scan_script = scan_script;
+    writeJPEG(sink, options);
+}
 
-    
-    Bitstream stream;
+void Image::writeJPEG(std::string file, const EncoderOptions& options) const
+{
+    // the file is truncated when it's opened, invalid options must not destroy an existing one
+    checkEncoderOptions(*this, options);
+    FileSink sink(file);
+    writeJPEG(sink, options);
+}
 
-    for (auto i = 0U; i < BitstreamCb.size1(); ++i) {
-        for (auto j = 0U; j < BitstreamCb.size2(); ++j) {
-            stream << BitstreamY(2*i,   2*j);
-            stream << BitstreamY(2*i,   2*j+1);
-            stream << BitstreamY(2*i+1, 2*j);
-            stream << BitstreamY(2*i+1, 2*j+1);
+void Image::writeJPEG(OutputSink& sink, const EncoderOptions& options) const
+{
+    auto start = high_resolution_clock::now();
 
-            stream << BitstreamCb(i, j) << BitstreamCr(i, j);
-        }
-    }
+    // printing some info
+    std::cout << "Processing image size: " << real_width << "x" << real_height << std::endl;
 
-    stream.fill();
-    jpeg << stream;
-    jpeg << sEOI();
+    Encoder encoder;
+    encoder.encode(*this, sink, options);
 
     auto end = high_resolution_clock::now();
     std::cout << "Encoding duration: " << duration_cast<milliseconds>(end - start).count() << " ms" << std::endl;
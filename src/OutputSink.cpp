@@ -0,0 +1,168 @@
+#include "OutputSink.hpp"
+
+#include <cassert>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#else
+#include <unistd.h>
+#include <fcntl.h>
+#endif
+
+//
+// FixedBufferSink
+//
+void FixedBufferSink::put(const uint8_t* data, size_t size)
+{
+    if (size > capacity - pos)
+        throw std::length_error("Output buffer is too small");
+
+    std::memcpy(buffer + pos, data, size);
+    pos += size;
+}
+
+//
+// FileDescriptorSink
+//
+FileDescriptorSink::FileDescriptorSink(int fd, size_t buffer_size)
+    : fd(fd), buffer(buffer_size), pos(0)
+{}
+
+FileDescriptorSink::~FileDescriptorSink()
+{
+    // the last chance for the buffered bytes, errors can't be reported here anymore
+    try {
+        flushBuffer();
+    }
+    catch (...) {}
+}
+
+void FileDescriptorSink::put(const uint8_t* data, size_t size)
+{
+    if (pos + size <= buffer.size()) {
+        std::memcpy(buffer.data() + pos, data, size);
+        pos += size;
+        return;
+    }
+
+    // doesn't fit anymore: the buffer goes out first, the data itself without copying it
+    flushBuffer();
+    if (size < buffer.size()) {
+        std::memcpy(buffer.data(), data, size);
+        pos = size;
+    }
+    else {
+        writeAll(data, size);
+    }
+}
+
+void FileDescriptorSink::flushBuffer()
+{
+    // pos is reset first, so a failing write isn't repeated by the destructor
+    auto size = pos;
+    pos = 0;
+    writeAll(buffer.data(), size);
+}
+
+void FileDescriptorSink::writeAll(const uint8_t* data, size_t size)
+{
+    // one write call per gigabyte at most, pipes and sockets may take less than that
+    const size_t max_write = 1U << 30;
+
+    while (size > 0) {
+#ifdef _WIN32
+        auto written = _write(fd, data, static_cast<unsigned int>(std::min(size, max_write)));
+#else
+        auto written = ::write(fd, data, std::min(size, max_write));
+#endif
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::runtime_error("Failed to write output: " + std::string(std::strerror(errno)));
+        }
+
+        data += written;
+        size -= written;
+    }
+}
+
+//
+// FileSink
+//
+static int openForWriting(const std::string& path)
+{
+#ifdef _WIN32
+    auto fd = _open(path.c_str(), _O_WRONLY | _O_CREAT | _O_TRUNC | _O_BINARY, _S_IREAD | _S_IWRITE);
+#else
+    auto fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+#endif
+    if (fd < 0)
+        throw std::runtime_error("Failed to open \"" + path + "\"");
+    return fd;
+}
+
+FileSink::FileSink(const std::string& path)
+    : FileDescriptorSink(openForWriting(path))
+{}
+
+FileSink::~FileSink()
+{
+    try {
+        finish();
+    }
+    catch (...) {}
+
+#ifdef _WIN32
+    _close(fd);
+#else
+    ::close(fd);
+#endif
+}
+
+//
+// CallbackSink
+//
+CallbackSink::CallbackSink(Callback callback, size_t chunk_size)
+    : callback(callback), chunk_size(chunk_size)
+{
+    assert(chunk_size > 0);
+    chunk.reserve(chunk_size);
+}
+
+void CallbackSink::put(const uint8_t* data, size_t size)
+{
+    // fill up the pending chunk
+    if (!chunk.empty()) {
+        auto n = std::min(size, chunk_size - chunk.size());
+        chunk.insert(chunk.end(), data, data + n);
+        data += n;
+        size -= n;
+
+        if (chunk.size() < chunk_size)
+            return;
+        callback(chunk.data(), chunk.size());
+        chunk.clear();
+    }
+
+    // whole chunks straight from the data
+    while (size >= chunk_size) {
+        callback(data, chunk_size);
+        data += chunk_size;
+        size -= chunk_size;
+    }
+
+    chunk.insert(chunk.end(), data, data + size);
+}
+
+void CallbackSink::finish()
+{
+    if (!chunk.empty()) {
+        callback(chunk.data(), chunk.size());
+        chunk.clear();
+    }
+}
@@ -0,0 +1,377 @@
+#include "Progressive.hpp"
+
+#include <sstream>
+#include <stdexcept>
+
+#include "JpegSegments.hpp"
+
+ScanScript defaultScanScript()
+{
+    ScanScript script = {
+        { { 0, 1, 2 }, 0, 0, 0, 1 },    // DC of all components, without the last bit
+        { { 0 }, 1, 5, 0, 2 },          // the lowest Y frequencies
+        { { 2 }, 1, 63, 0, 1 },         // chroma AC
+        { { 1 }, 1, 63, 0, 1 },
+        { { 0 }, 6, 63, 0, 2 },         // the rest of Y
+        { { 0 }, 1, 63, 2, 1 },         // refinements up to the last bit
+        { { 0, 1, 2 }, 0, 0, 1, 0 },
+        { { 2 }, 1, 63, 1, 0 },
+        { { 1 }, 1, 63, 1, 0 },
+        { { 0 }, 1, 63, 1, 0 },
+    };
+    return script;
+}
+
+void checkScanScript(const ScanScript& script)
+{
+    // approximation_low of every coefficient of every component so far, -1 if it wasn't sent yet
+    int low[3][64];
+    for (auto& component : low) {
+        for (auto& coefficient : component)
+            coefficient = -1;
+    }
+
+    for (const auto& scan : script) {
+        if (scan.components.empty() || scan.components.size() > 3)
+            throw std::invalid_argument("Scan script: a scan needs one to three components");
+        if (scan.spectral_start > scan.spectral_end || scan.spectral_end > 63)
+            throw std::invalid_argument("Scan script: invalid spectral selection");
+        if (scan.spectral_start == 0 && scan.spectral_end != 0)
+            throw std::invalid_argument("Scan script: DC and AC coefficients need separate scans");
+        if (scan.spectral_start > 0 && scan.components.size() != 1)
+            throw std::invalid_argument("Scan script: AC scans have only one component");
+        if (scan.approximation_low > 13 || (scan.approximation_high != 0 && scan.approximation_high != scan.approximation_low + 1))
+            throw std::invalid_argument("Scan script: invalid successive approximation");
+
+        for (auto c : scan.components) {
+            if (c < 0 || c > 2)
+                throw std::invalid_argument("Scan script: invalid component");
+            if (scan.spectral_start > 0 && low[c][0] < 0)
+                throw std::invalid_argument("Scan script: AC scan before the first DC scan of the component");
+
+            for (int k = scan.spectral_start; k <= scan.spectral_end; ++k) {
+                bool first = low[c][k] < 0;
+                if (first ? scan.approximation_high != 0 : scan.approximation_high != low[c][k])
+                    throw std::invalid_argument("Scan script: coefficients are sent twice or refined out of order");
+                low[c][k] = scan.approximation_low;
+            }
+        }
+    }
+
+    for (auto& component : low) {
+        for (auto coefficient : component) {
+            if (coefficient != 0)
+                throw std::invalid_argument("Scan script: not all coefficients are sent completely");
+        }
+    }
+}
+
+ScanScript parseScanScript(const std::string& text)
+{
+    ScanScript script;
+    std::stringstream scans(text);
+    std::string scan_text;
+
+    while (std::getline(scans, scan_text, ';')) {
+        if (scan_text.find_first_not_of(" \t\r\n") == std::string::npos)
+            continue;
+
+        auto colon = scan_text.find(':');
+        if (colon == std::string::npos)
+            throw std::invalid_argument("Scan script: missing ':' in \"" + scan_text + "\"");
+
+        ProgressiveScan scan;
+        std::stringstream components(scan_text.substr(0, colon));
+        int component;
+        while (components >> component)
+            scan.components.push_back(component);
+        if (!components.eof())
+            throw std::invalid_argument("Scan script: invalid components in \"" + scan_text + "\"");
+
+        std::stringstream parameters(scan_text.substr(colon + 1));
+        int values[4];
+        for (auto& value : values) {
+            if (!(parameters >> value) || value < 0 || value > 63)
+                throw std::invalid_argument("Scan script: invalid parameters in \"" + scan_text + "\"");
+        }
+        scan.spectral_start = static_cast<uint8_t>(values[0]);
+        scan.spectral_end = static_cast<uint8_t>(values[1]);
+        scan.approximation_high = static_cast<uint8_t>(values[2]);
+        scan.approximation_low = static_cast<uint8_t>(values[3]);
+        script.push_back(scan);
+    }
+
+    checkScanScript(script);
+    return script;
+}
+
+//
+// scan coding
+//
+namespace {
+
+// first pass: only counts the symbols for the two huffman tables of a scan
+struct SymbolCounter {
+    SymbolHistogram histograms[2];
+
+    void symbol(int table, uint8_t symbol) { ++histograms[table][symbol]; }
+    void bits(uint32_t, int) {}
+};
+
+// second pass: writes the codes and bits
+struct ScanWriter {
+    const CodeTable* tables[2];
+    BitWriter* writer;
+
+    void symbol(int table, uint8_t symbol) {
+        assert(tables[table]->length(symbol) > 0);
+        writer->push_back_LSB_mode(tables[table]->code(symbol), tables[table]->length(symbol));
+    }
+    void bits(uint32_t bits, int number_of_bits) { writer->push_back_LSB_mode(bits, number_of_bits); }
+};
+
+// coefficient at zigzag position k of a block
+inline int coefficient(const int* block, size_t stride, int k) {
+    auto index = zigzag_order[k];
+    return block[(index / 8) * stride + index % 8];
+}
+
+// calls block_fn(component, block, stride) in the order of the scan: MCU by MCU if it has more than one component,
+// else only the blocks covering the component in raster order
+template <typename BlockFn>
+void forEachScanBlock(const ProgressiveScan& scan, const ProgressiveComponent components[3], uint mcus_x, uint mcus_y, BlockFn block_fn)
+{
+    if (scan.components.size() == 1) {
+        const auto& component = components[scan.components[0]];
+        const uint blocks_x = (component.width + 7) / 8;
+        const uint blocks_y = (component.height + 7) / 8;
+
+        for (uint by = 0; by < blocks_y; ++by) {
+            for (uint bx = 0; bx < blocks_x; ++bx)
+                block_fn(scan.components[0], component.coefficients + 8 * (by * component.stride + bx), component.stride);
+        }
+        return;
+    }
+
+    for (uint my = 0; my < mcus_y; ++my) {
+        for (uint mx = 0; mx < mcus_x; ++mx) {
+            for (auto c : scan.components) {
+                const auto& component = components[c];
+                for (uint v = 0; v < component.v_blocks; ++v) {
+                    for (uint h = 0; h < component.h_blocks; ++h) {
+                        const size_t row = 8 * (my * component.v_blocks + v), column = 8 * (mx * component.h_blocks + h);
+                        block_fn(c, component.coefficients + row * component.stride + column, component.stride);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// DC scans: table 0 for Y, 1 for the chroma components
+template <typename Emitter>
+void codeDCScan(const ProgressiveScan& scan, const ProgressiveComponent components[3], uint mcus_x, uint mcus_y, Emitter& emit)
+{
+    const int al = scan.approximation_low;
+    int previous_dc[3] = { 0, 0, 0 };
+
+    forEachScanBlock(scan, components, mcus_x, mcus_y, [&](int c, const int* block, size_t) {
+        // point transform of the DC is an arithmetic shift
+        int value = block[0] >> al;
+
+        if (scan.approximation_high == 0) {
+            auto category_bits = getCategoryAndBits(value - previous_dc[c]);
+            previous_dc[c] = value;
+            emit.symbol(c == 0 ? 0 : 1, category_bits.category);
+            emit.bits(category_bits.bits, category_bits.category);
+        }
+        else {
+            // refinement: just the next bit
+            emit.bits(value & 1, 1);
+        }
+    });
+}
+
+// first AC scan of a band: like baseline, but runs of blocks without any (remaining) coefficient are one EOBn symbol
+template <typename Emitter>
+void codeACFirstScan(const ProgressiveScan& scan, const ProgressiveComponent components[3], uint mcus_x, uint mcus_y, Emitter& emit)
+{
+    const int al = scan.approximation_low;
+    uint eob_run = 0;
+
+    auto emitEOBRun = [&]() {
+        if (eob_run == 0)
+            return;
+        int bits = 31 - countLeadingZeros(eob_run);
+        emit.symbol(0, static_cast<uint8_t>(bits << 4));
+        emit.bits(eob_run, bits);
+        eob_run = 0;
+    };
+
+    forEachScanBlock(scan, components, mcus_x, mcus_y, [&](int, const int* block, size_t stride) {
+        int run = 0;
+        for (int k = scan.spectral_start; k <= scan.spectral_end; ++k) {
+            int value = coefficient(block, stride, k);
+            // rounds towards 0, the sign is applied afterwards
+            int magnitude = (value < 0 ? -value : value) >> al;
+            if (magnitude == 0) {
+                ++run;
+                continue;
+            }
+
+            emitEOBRun();
+            for (; run > 15; run -= 16)
+                emit.symbol(0, 0xF0);
+
+            auto category_bits = getCategoryAndBits(value < 0 ? -magnitude : magnitude);
+            emit.symbol(0, static_cast<uint8_t>((run << 4) | category_bits.category));
+            emit.bits(category_bits.bits, category_bits.category);
+            run = 0;
+        }
+
+        if (run > 0 && ++eob_run == 0x7FFF)
+            emitEOBRun();
+    });
+
+    emitEOBRun();
+}
+
+// AC refinement: coefficients that become nonzero are coded like in the first scan (with magnitude 1),
+// the ones that were already nonzero get their next bit as correction bit behind the next symbol
+template <typename Emitter>
+void codeACRefinementScan(const ProgressiveScan& scan, const ProgressiveComponent components[3], uint mcus_x, uint mcus_y, Emitter& emit)
+{
+    const int al = scan.approximation_low;
+    uint eob_run = 0;
+    std::vector<uint8_t> eob_bits;      // correction bits of the blocks in the EOB run
+    std::vector<uint8_t> block_bits;    // correction bits in the current block since the last symbol
+
+    auto emitBits = [&](std::vector<uint8_t>& bits) {
+        for (auto bit : bits)
+            emit.bits(bit, 1);
+        bits.clear();
+    };
+    auto emitEOBRun = [&]() {
+        if (eob_run == 0)
+            return;
+        int bits = 31 - countLeadingZeros(eob_run);
+        emit.symbol(0, static_cast<uint8_t>(bits << 4));
+        emit.bits(eob_run, bits);
+        eob_run = 0;
+        emitBits(eob_bits);
+    };
+
+    forEachScanBlock(scan, components, mcus_x, mcus_y, [&](int, const int* block, size_t stride) {
+        int magnitudes[64];
+        int last_new = -1; // position of the last coefficient that becomes nonzero in this scan
+        for (int k = scan.spectral_start; k <= scan.spectral_end; ++k) {
+            int value = coefficient(block, stride, k);
+            magnitudes[k] = (value < 0 ? -value : value) >> al;
+            if (magnitudes[k] == 1)
+                last_new = k;
+        }
+
+        int run = 0;
+        for (int k = scan.spectral_start; k <= scan.spectral_end; ++k) {
+            if (magnitudes[k] == 0) {
+                ++run;
+                continue;
+            }
+
+            // ZRLs are needed only if a new coefficient follows, otherwise the EOB covers the zeros
+            while (run > 15 && k <= last_new) {
+                emitEOBRun();
+                emit.symbol(0, 0xF0);
+                run -= 16;
+                emitBits(block_bits);
+            }
+
+            if (magnitudes[k] > 1) {
+                block_bits.push_back(static_cast<uint8_t>(magnitudes[k] & 1));
+                continue;
+            }
+
+            emitEOBRun();
+            emit.symbol(0, static_cast<uint8_t>((run << 4) | 1));
+            emit.bits(coefficient(block, stride, k) < 0 ? 0 : 1, 1);
+            emitBits(block_bits);
+            run = 0;
+        }
+
+        if (run > 0 || !block_bits.empty()) {
+            ++eob_run;
+            eob_bits.insert(eob_bits.end(), block_bits.begin(), block_bits.end());
+            block_bits.clear();
+
+            // the decoder has to keep the correction bits of the whole run, libjpeg's limit is 1000
+            if (eob_run == 0x7FFF || eob_bits.size() > 1000 - 64 + 1)
+                emitEOBRun();
+        }
+    });
+
+    emitEOBRun();
+}
+
+template <typename Emitter>
+void codeScan(const ProgressiveScan& scan, const ProgressiveComponent components[3], uint mcus_x, uint mcus_y, Emitter& emit)
+{
+    if (scan.spectral_start == 0)
+        codeDCScan(scan, components, mcus_x, mcus_y, emit);
+    else if (scan.approximation_high == 0)
+        codeACFirstScan(scan, components, mcus_x, mcus_y, emit);
+    else
+        codeACRefinementScan(scan, components, mcus_x, mcus_y, emit);
+}
+
+} // namespace
+
+void writeProgressiveScans(OutputSink& sink, const ProgressiveComponent components[3], uint mcus_x, uint mcus_y,
+                           const ScanScript& script, BitWriter& writer)
+{
+    using namespace Segment;
+
+    for (const auto& scan : script) {
+        const bool dc = scan.spectral_start == 0;
+        const bool huffman_coded = !(dc && scan.approximation_high > 0);
+
+        // tables of this scan from its own statistics
+        CodeTable tables[2];
+        if (huffman_coded) {
+            SymbolCounter counter;
+            codeScan(scan, components, mcus_x, mcus_y, counter);
+
+            sDHT DHT;
+            for (int t = 0; t < 2; ++t) {
+                if (counter.histograms[t] == SymbolHistogram())
+                    continue;
+                auto code = generateHuffmanCode(counter.histograms[t]);
+                tables[t] = code.first;
+                DHT.pushCodeData(code.second, dc ? sDHT::DC : sDHT::AC, t == 0 ? sDHT::First : sDHT::Second);
+            }
+            sink << DHT;
+        }
+
+        const ComponentSetup::ID ids[] = { ComponentSetup::Y, ComponentSetup::Cb, ComponentSetup::Cr };
+        sSOS SOS;
+        if (scan.components.size() == 1) {
+            auto c = scan.components[0];
+            auto table = (dc && c != 0) ? sDHT::Second : sDHT::First;
+            SOS.setupSingle(ids[c], table, table);
+        }
+        else {
+            SOS.setComponentCount(static_cast<Byte>(scan.components.size()));
+            for (auto i = 0U; i < scan.components.size(); ++i) {
+                auto c = scan.components[i];
+                SOS.setupComponent(i, ids[c], c == 0 ? sDHT::First : sDHT::Second, sDHT::First);
+            }
+        }
+        sink << SOS.setSpectralSelection(scan.spectral_start, scan.spectral_end)
+                   .setSuccessiveApproximation(scan.approximation_high, scan.approximation_low);
+
+        writer.clear();
+        ScanWriter scan_writer = { { &tables[0], &tables[1] }, &writer };
+        codeScan(scan, components, mcus_x, mcus_y, scan_writer);
+        writer.flush();
+        sink.write(writer.data(), writer.byteCount());
+    }
+}
@@ -0,0 +1,114 @@
+#include "TableProfile.hpp"
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+TableProfile trainTableProfile(SymbolStatistics statistics) {
+    reserveDCSymbols(statistics.Y_DC);
+    reserveACSymbols(statistics.Y_AC);
+    reserveDCSymbols(statistics.C_DC);
+    reserveACSymbols(statistics.C_AC);
+
+    TableProfile profile;
+    profile.Y_DC = generateHuffmanCode(statistics.Y_DC).second;
+    profile.Y_AC = generateHuffmanCode(statistics.Y_AC).second;
+    profile.C_DC = generateHuffmanCode(statistics.C_DC).second;
+    profile.C_AC = generateHuffmanCode(statistics.C_AC).second;
+    return profile;
+}
+
+static const char* const table_names[] = { "Y_DC", "Y_AC", "C_DC", "C_AC" };
+
+void saveTableProfile(const TableProfile& profile, const std::string& path) {
+    std::ofstream out(path);
+    if (!out)
+        throw std::runtime_error("Failed to open \"" + path + "\"");
+
+    const SymbolsPerLength* tables[] = { &profile.Y_DC, &profile.Y_AC, &profile.C_DC, &profile.C_AC };
+
+    out << "# jpgEnc huffman table profile" << std::endl;
+    for (int t = 0; t < 4; ++t) {
+        auto& symbols = *tables[t];
+        assert(symbols.size() == 17);
+
+        out << table_names[t] << std::endl;
+        for (int length = 1; length <= 16; ++length)
+            out << symbols[length].size() << (length < 16 ? " " : "\n");
+
+        for (int length = 1; length <= 16; ++length)
+            for (auto symbol : symbols[length])
+                out << symbol << " ";
+        out << std::endl;
+    }
+}
+
+// the codes must fit into 16 bits without a code consisting of only ones, and every symbol the encoder can produce needs a code
+static void checkTable(const SymbolsPerLength& symbols, bool dc, const std::string& name) {
+    uint32_t code_space = 0; // in units of 2^-16
+    SymbolHistogram present;
+    for (int length = 1; length <= 16; ++length) {
+        code_space += static_cast<uint32_t>(symbols[length].size()) << (16 - length);
+        for (auto symbol : symbols[length]) {
+            if (symbol < 0 || symbol > 255 || present[symbol])
+                throw std::runtime_error("Table profile: invalid or duplicate symbol in " + name);
+            present[symbol] = 1;
+        }
+    }
+    if (code_space >= (1U << 16))
+        throw std::runtime_error("Table profile: too many codes in " + name);
+
+    SymbolHistogram required;
+    if (dc)
+        reserveDCSymbols(required);
+    else
+        reserveACSymbols(required);
+    for (auto i = 0U; i < required.size(); ++i) {
+        if (required[i] && !present[i])
+            throw std::runtime_error("Table profile: missing symbol in " + name);
+    }
+}
+
+TableProfile loadTableProfile(const std::string& path) {
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("Failed to open \"" + path + "\"");
+
+    // drop comments
+    std::stringstream content;
+    std::string line;
+    while (std::getline(in, line)) {
+        if (!line.empty() && line[0] != '#')
+            content << line << "\n";
+    }
+
+    TableProfile profile;
+    SymbolsPerLength* tables[] = { &profile.Y_DC, &profile.Y_AC, &profile.C_DC, &profile.C_AC };
+
+    for (int t = 0; t < 4; ++t) {
+        std::string name;
+        content >> name;
+        if (name != table_names[t])
+            throw std::runtime_error("Table profile: expected table " + std::string(table_names[t]));
+
+        int counts[16];
+        for (auto& count : counts) {
+            if (!(content >> count) || count < 0 || count > 256)
+                throw std::runtime_error("Table profile: invalid code count in " + name);
+        }
+
+        auto& symbols = *tables[t];
+        symbols = SymbolsPerLength(17);
+        for (int length = 1; length <= 16; ++length) {
+            symbols[length].resize(counts[length - 1]);
+            for (auto& symbol : symbols[length]) {
+                if (!(content >> symbol))
+                    throw std::runtime_error("Table profile: missing symbols in " + name);
+            }
+        }
+
+        checkTable(symbols, t % 2 == 0, name);
+    }
+
+    return profile;
+}
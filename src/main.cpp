@@ -1,32 +1,183 @@
+#include <algorithm>
 #include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <string>
 
 #include <boost/dynamic_bitset.hpp>
 
 #include "Image.hpp"
+#include "Encoder.hpp"
 
+static void printUsage(std::ostream& out, const char* program)
+{
+    out << "Usage: " << program << " <image.ppm> [<image.jpg>|-] [<profile>] [options]\n"
+        "  the jpeg goes to noname.jpg by default, - writes it to stdout. a profile selects --huffman profile\n"
+        "  --subsampling 444|422|411|420|420m|420lm   chroma layout and filter (420m)\n"
+        "  --dct arai|matrix|simple                   DCT kernel (arai)\n"
+        "  --qtables <file>                           64 luma and 64 chroma quantization values, row major\n"
+        "  --quality <1-100>                          IJG scaling of the quantization tables (50)\n"
+        "  --max-size <bytes>                         highest quality (up to --quality) that fits\n"
+        "  --huffman optimized|standard|sampled|profile\n"
+        "  --profile <file>                           table profile trained with jpgEncTrain\n"
+        "  --restart <mcus>                           restart interval\n"
+        "  --non-interleaved                          one scan per component\n"
+        "  --progressive                              progressive with the default scan script\n"
+        "  --scans <script>                           progressive with a scan script, e.g. \"0 1 2: 0 0 0 0; 0: 1 63 0 0; ...\"\n"
+        "  --threads <n>                              OpenMP threads\n";
+}
+
+// plain text file with the 64 luma and the 64 chroma values (1 to 255) in row major order
+static void loadQuantizationTables(const std::string& path, QuantizationTable& table_y, QuantizationTable& table_c)
+{
+    std::ifstream in(path);
+    if (!in)
+        throw std::runtime_error("can't open " + path);
+
+    for (int i = 0; i < 128; ++i) {
+        int value = 0;
+        if (!(in >> value) || value < 1 || value > 255)
+            throw std::runtime_error(path + ": 128 quantization values from 1 to 255 expected");
+        (i < 64 ? table_y[i] : table_c[i - 64]) = static_cast<Byte>(value);
+    }
+}
+
+static Image::SubsamplingMode parseSubsampling(const std::string& name)
+{
+    if (name == "444")   return Image::S444;
+    if (name == "422")   return Image::S422;
+    if (name == "411")   return Image::S411;
+    if (name == "420")   return Image::S420;
+    if (name == "420m")  return Image::S420_m;
+    if (name == "420lm") return Image::S420_lm;
+    throw std::invalid_argument("unknown subsampling " + name);
+}
+
+static Image::DCTMode parseDCT(const std::string& name)
+{
+    if (name == "arai")   return Image::Arai;
+    if (name == "matrix") return Image::Matrix;
+    if (name == "simple") return Image::Simple;
+    throw std::invalid_argument("unknown DCT " + name);
+}
+
+static Image::HuffmanMode parseHuffman(const std::string& name)
+{
+    if (name == "optimized") return Image::Optimized;
+    if (name == "standard")  return Image::Standard;
+    if (name == "sampled")   return Image::Sampled;
+    if (name == "profile")   return Image::Profile;
+    throw std::invalid_argument("unknown huffman mode " + name);
+}
 
 int main(int argc, char *argv[]) {
 
     if (argc < 2) {
         std::cout << "No filename was written" << std::endl;
+        printUsage(std::cout, argv[0]);
         return 0;
     }
 
-    std::string ppmFilename = argv[1];
-    auto img = loadPPM(ppmFilename);
+    try {
+        EncoderOptions options;
+        TableProfile table_profile;
+        bool profile_loaded = false;
+        ScanScript scan_script;
+        std::vector<std::string> positional;
+
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg.size() < 3 || arg.compare(0, 2, "--") != 0) {
+                positional.push_back(arg);
+                continue;
+            }
+
+            // flags without a value
+            if (arg == "--non-interleaved") {
+                options.interleaved = false;
+                continue;
+            }
+            if (arg == "--progressive") {
+                scan_script = defaultScanScript();
+                options.scan_script = &scan_script;
+                continue;
+            }
 
-    std::string jpgFilename;
+            const char* value_options[] = { "--subsampling", "--dct", "--qtables", "--quality", "--max-size", "--huffman", "--profile", "--restart", "--scans", "--threads" };
+            if (std::find(std::begin(value_options), std::end(value_options), arg) == std::end(value_options))
+                throw std::invalid_argument("unknown option " + arg);
+            if (i + 1 == argc)
+                throw std::invalid_argument(arg + " needs a value");
+            std::string value = argv[++i];
 
-    if (argc < 3)
-    {
-        jpgFilename = "noname.jpg";
+            if (arg == "--subsampling")
+                options.subsampling = parseSubsampling(value);
+            else if (arg == "--dct")
+                options.dct_mode = parseDCT(value);
+            else if (arg == "--qtables")
+                loadQuantizationTables(value, options.quantization_y, options.quantization_c);
+            else if (arg == "--quality")
+                options.quality = std::stoi(value);
+            else if (arg == "--max-size")
+                options.target_size = std::stoul(value);
+            else if (arg == "--huffman")
+                options.huffman_mode = parseHuffman(value);
+            else if (arg == "--profile") {
+                table_profile = loadTableProfile(value);
+                profile_loaded = true;
+                options.huffman_mode = Image::Profile;
+            }
+            else if (arg == "--restart")
+                options.restart_interval = std::stoi(value);
+            else if (arg == "--scans") {
+                scan_script = parseScanScript(value);
+                options.scan_script = &scan_script;
+            }
+            else
+                options.threads = std::stoi(value);
+        }
+
+        if (positional.empty() || positional.size() > 3)
+            throw std::invalid_argument("one image, an optional jpeg and an optional profile expected");
+
+        std::string ppmFilename = positional[0];
+        std::string jpgFilename = positional.size() < 2 ? "noname.jpg" : positional[1];
+
+        // the jpeg goes to stdout, the info the loader and writeJPEG print to stderr.
+        // (loadPPM turns off the stdio syncing, that would reset the buffer of cout if it happened later)
+        const bool to_stdout = jpgFilename == "-";
+        if (to_stdout) {
+            std::ios::sync_with_stdio(false);
+            std::cout.rdbuf(std::cerr.rdbuf());
+        }
+
+        auto img = loadPPM(ppmFilename);
+
+        // optional table profile trained with jpgEncTrain
+        if (positional.size() == 3) {
+            table_profile = loadTableProfile(positional[2]);
+            profile_loaded = true;
+            options.huffman_mode = Image::Profile;
+        }
+        if (options.huffman_mode == Image::Profile) {
+            if (!profile_loaded)
+                throw std::invalid_argument("the profile huffman mode needs a profile");
+            options.table_profile = &table_profile;
+        }
+
+        if (to_stdout) {
+            FileDescriptorSink sink(1);
+            img.writeJPEG(sink, options);
+        }
+        else {
+            img.writeJPEG(jpgFilename, options);
+        }
     }
-    else
-    {
-        jpgFilename = argv[2];
+    catch (const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        printUsage(std::cerr, argv[0]);
+        return 1;
     }
 
-    img.writeJPEG(jpgFilename);
-
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,73 @@
+#include "test/unittest.hpp"
+
+#include <vector>
+#include <random>
+
+#include "BitstreamGeneric.hpp"
+#include "BitReader.hpp"
+#include "BitWriter.hpp"
+
+BOOST_AUTO_TEST_CASE(bit_reader_matches_extract) {
+    std::mt19937 random(17);
+
+    Bitstream stream;
+    for (int i = 0; i < 5000; ++i)
+        stream.push_back_LSB_mode(random(), 1 + random() % 32);
+
+    auto bytes = stream.bytes();
+    BitReader reader(bytes.data(), bytes.size());
+
+    size_t pos = 0;
+    while (pos + 32 <= stream.size()) {
+        int length = 1 + random() % 32;
+        auto expected = stream.extract(length, pos) >> (32 - length);
+
+        BOOST_REQUIRE_EQUAL(reader.peek(length), expected);
+        BOOST_REQUIRE_EQUAL(reader.read(length), expected);
+        pos += length;
+        BOOST_REQUIRE_EQUAL(reader.position(), pos);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bit_reader_end_of_data) {
+    const uint8_t data[] = { 0xA5, 0x0F };
+    BitReader reader(data, sizeof(data));
+
+    BOOST_CHECK_EQUAL(reader.read(4), 0xA);
+    BOOST_CHECK(!reader.atEnd());
+    BOOST_CHECK_EQUAL(reader.read(12), 0x50F);
+    BOOST_CHECK(reader.atEnd());
+
+    // behind the end there are only 1s
+    BOOST_CHECK_EQUAL(reader.read(32), 0xFFFFFFFF);
+}
+
+BOOST_AUTO_TEST_CASE(bit_reader_unstuffing) {
+    // the same bits written with stuffing come back without it, whatever the alignment of the 0xFF bytes
+    std::mt19937 random(23);
+    std::vector<std::pair<uint32_t, int>> values;
+
+    BitWriter writer;
+    for (int i = 0; i < 3000; ++i) {
+        int length = 1 + random() % 16;
+        uint32_t value = (i % 4 == 0) ? 0xFFFF : random();
+        value &= (1U << length) - 1;
+        values.emplace_back(value, length);
+        writer.push_back_LSB_mode(value, length);
+    }
+    writer.flush();
+
+    // scan data is followed by a marker, e.g. EOI
+    std::vector<uint8_t> data(writer.data(), writer.data() + writer.byteCount());
+    data.push_back(0xFF);
+    data.push_back(0xD9);
+
+    BitReader reader(data.data(), data.size(), true);
+    for (auto& value : values)
+        BOOST_REQUIRE_EQUAL(reader.read(value.second), value.first);
+
+    // the padding up to the marker
+    reader.skip((8 - reader.position() % 8) % 8);
+    BOOST_CHECK(reader.atEnd());
+    BOOST_CHECK_EQUAL(reader.marker(), 0xD9);
+}
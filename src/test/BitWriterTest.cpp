@@ -0,0 +1,70 @@
+#include "test/unittest.hpp"
+
+#include <sstream>
+#include <random>
+
+#include "BitstreamGeneric.hpp"
+#include "BitWriter.hpp"
+
+static std::string bytesOf(BitWriter& writer) {
+    writer.flush();
+    return std::string(reinterpret_cast<const char*>(writer.data()), writer.byteCount());
+}
+
+BOOST_AUTO_TEST_CASE(bit_writer_stuffing) {
+    BitWriter writer;
+    writer.push_back_LSB_mode(0xFF, 8);
+    writer.push_back_LSB_mode(0x1, 4);
+    BOOST_CHECK_EQUAL(writer.size(), 12);
+
+    // 1111 1111 | 0001 + 1111 padding
+    BOOST_CHECK(bytesOf(writer) == std::string("\xFF\x00\x1F", 3));
+
+    // all ones: every byte is stuffed, the padding too
+    BitWriter ones;
+    for (int i = 0; i < 10; ++i)
+        ones.push_back_LSB_mode(0x7FFF, 15);
+    auto bytes = bytesOf(ones);
+    BOOST_CHECK_EQUAL(bytes.size(), 2 * 19);
+    for (auto i = 0U; i < bytes.size(); i += 2) {
+        BOOST_CHECK_EQUAL(static_cast<uint8_t>(bytes[i]), 0xFF);
+        BOOST_CHECK_EQUAL(static_cast<uint8_t>(bytes[i + 1]), 0x00);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(bit_writer_matches_bitstream) {
+    std::mt19937 random(3);
+
+    BitWriter writer(16); // has to grow
+    Bitstream8 stream;
+    for (int i = 0; i < 20000; ++i) {
+        int length = random() % 33;
+        uint32_t data = random();
+        // lots of ones to get 0xFF bytes
+        if (i % 3 == 0)
+            data |= 0xFFFFF0F0;
+
+        writer.push_back_LSB_mode(data, length);
+        stream.push_back_LSB_mode(data, length);
+    }
+    BOOST_CHECK_EQUAL(writer.size(), stream.size());
+
+    // the ostream operator of a one byte Bitstream does the stuffing
+    stream.fill();
+    std::ostringstream expected;
+    expected << stream;
+
+    BOOST_CHECK(bytesOf(writer) == expected.str());
+}
+
+BOOST_AUTO_TEST_CASE(bit_writer_without_stuffing) {
+    BitWriter raw(0, false);
+    raw.push_back_LSB_mode(0xFFFF, 16);
+    raw.push_back_LSB_mode(0x3, 4);
+    BOOST_CHECK(bytesOf(raw) == std::string("\xFF\xFF\x3F", 3));
+
+    // whole bytes are stuffed later on
+    BitWriter stuffed;
+    stuffed.writeBytes(raw.data(), raw.byteCount());
+    BOOST_CHECK(bytesOf(stuffed) == std::string("\xFF\x00\xFF\x00\x3F", 5));
+}
@@ -3,6 +3,7 @@
 #include <iostream>
 #include <chrono>
 #include <fstream>
+#include <sstream>
 
 #include "BitstreamGeneric.hpp"
 
@@ -218,4 +219,97 @@ BOOST_AUTO_TEST_CASE(push_back_lsb) {
     // extracting different types
     auto v = b8.extractT<uint8_t>(4, 0); // 0100 0000
     BOOST_CHECK_EQUAL(v, 0x40);
-}
\ No newline at end of file
+}
+template <typename BitstreamType>
+void checkConcatenation() {
+    srand(11);
+    BitstreamType joined, expected;
+    for (int n = 0; n < 300; ++n) {
+        // random lengths, from nothing up to several blocks
+        BitstreamType part;
+        auto length = rand() % 150;
+        for (int i = 0; i < length; ++i)
+            part << (rand() % 3 == 0);
+
+        joined << part;
+        for (auto i = 0U; i < part.size(); ++i)
+            expected << static_cast<bool>(part[i]);
+
+        BOOST_REQUIRE(joined == expected);
+    }
+
+    // appending single bits after a concatenation
+    joined << true << false;
+    expected << true << false;
+    BOOST_CHECK(joined == expected);
+
+    // filling after a concatenation that ends on a block boundary doesn't add anything
+    BitstreamType aligned, block;
+    for (auto i = 0U; i < BitstreamType::block_size; ++i)
+        block << true;
+    aligned << block;
+    aligned.fill();
+    BOOST_CHECK_EQUAL(aligned.size(), static_cast<unsigned int>(BitstreamType::block_size));
+
+    // unaligned concatenation of a filled stream
+    BitstreamType filled{ true, false, true };
+    filled.fill();
+    BitstreamType prefix{ false };
+    prefix << filled;
+    BOOST_CHECK_EQUAL(prefix.size(), filled.size() + 1);
+    BOOST_CHECK_EQUAL(prefix.extract(4, 0), 0x50000000U); // 0101
+}
+
+BOOST_AUTO_TEST_CASE(concatenation) {
+    checkConcatenation<Bitstream8>();
+    checkConcatenation<Bitstream64>();
+}
+
+BOOST_AUTO_TEST_CASE(byte_stuffing) {
+    srand(5);
+    for (int n = 0; n < 50; ++n) {
+        // random data with 0xFF bytes at the start, in the middle of the 16 byte chunks and at the end
+        std::vector<uint8_t> data(rand() % 200);
+        for (auto& byte : data)
+            byte = (rand() % 5 == 0) ? 0xFF : static_cast<uint8_t>(rand());
+        if (!data.empty() && n % 2)
+            data.back() = data.front() = 0xFF;
+
+        std::vector<uint8_t> expected;
+        for (auto byte : data) {
+            expected.push_back(byte);
+            if (byte == 0xFF)
+                expected.push_back(0x00);
+        }
+
+        std::vector<uint8_t> stuffed(2 * data.size());
+        auto size = stuffBytes(data.data(), data.size(), stuffed.data());
+        stuffed.resize(size);
+        BOOST_CHECK(stuffed == expected);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(stuffed_output_for_all_block_types) {
+    // the same bits in one byte and eight byte blocks give the same stuffed bytes
+    Bitstream8 b8;
+    Bitstream64 b64;
+    srand(9);
+    for (int i = 0; i < 64 * 40; ++i) {
+        bool bit = (i / 8) % 3 == 0 || rand() % 2;
+        b8 << bit;
+        b64 << bit;
+    }
+
+    std::ostringstream out8, out64;
+    out8 << b8;
+    out64 << b64;
+    BOOST_CHECK(out8.str() == out64.str());
+    BOOST_CHECK(out8.str().size() > b8.size() / 8); // some 0xFF were stuffed
+
+    // reading back gives the stuffed bytes as they are
+    std::istringstream in(std::string("\xAB\xCD\xEF\x01\x23\x45\x67\x89", 8));
+    Bitstream64 read;
+    in >> read;
+    BOOST_CHECK_EQUAL(read.size(), 64);
+    BOOST_CHECK_EQUAL(read.extract(32, 0), 0xABCDEF01U);
+}
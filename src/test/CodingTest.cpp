@@ -1,6 +1,7 @@
 #include "test/unittest.hpp"
 
 #include "Coding.hpp"
+#include "BitWriter.hpp"
 
 BOOST_AUTO_TEST_CASE(rle_AC_test) {
     std::vector<int> data{ -111, 57, 0, 0, 0, 0, 0, 0,
@@ -161,3 +162,151 @@ BOOST_AUTO_TEST_CASE(getCategoryAndCode_test) {
     BOOST_CHECK(std::make_pair(cat, Bitstream(1023, cat)) == getCategoryAndCode( 1023));
 }
 
+
+BOOST_AUTO_TEST_CASE(getCategoryAndBits_test) {
+    BOOST_CHECK_EQUAL(getCategory(0), 0);
+    BOOST_CHECK_EQUAL(getCategory(1), 1);
+    BOOST_CHECK_EQUAL(getCategory(-1), 1);
+    BOOST_CHECK_EQUAL(getCategory(-1024), 11);
+    BOOST_CHECK_EQUAL(getCategory(32767), 15);
+
+    // compare with the category bounds 2^(category-1) <= |value| < 2^category
+    for (int value = -2047; value <= 2047; ++value) {
+        auto result = getCategoryAndBits(value);
+        auto abs_val = abs(value);
+
+        if (value == 0) {
+            BOOST_CHECK_EQUAL(result.category, 0);
+            BOOST_CHECK_EQUAL(result.bits, 0);
+            continue;
+        }
+
+        BOOST_CHECK(abs_val >= (1 << (result.category - 1)) && abs_val < (1 << result.category));
+
+        auto expected_bits = value > 0 ? value : ((1 << result.category) - 1) - abs_val;
+        BOOST_CHECK_EQUAL(result.bits, expected_bits);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(zigzag_tables_test) {
+    for (int i = 0; i < 64; ++i)
+        BOOST_CHECK_EQUAL(zigzag_index[zigzag_order[i]], i);
+
+    BOOST_CHECK_EQUAL(zigzag(2), 8);
+    BOOST_CHECK_EQUAL(zigzag(35), 56);
+    BOOST_CHECK_EQUAL(zigzag(63), 63);
+}
+
+BOOST_AUTO_TEST_CASE(rle_AC_bitmask_matches_linear_scan) {
+    srand(42);
+    for (int n = 0; n < 1000; ++n) {
+        // sparse blocks with long zero runs, every 10th block is completely empty
+        matrix<int> block(8, 8);
+        for (auto i = 0U; i < 64; ++i)
+            block.data()[i] = (n % 10 != 0 && rand() % 8 == 0) ? rand() % 64 - 32 : 0;
+        if (n % 3 == 0)
+            block(7, 7) = 5;
+
+        // the vector version takes zigzag sorted data and scans it one by one
+        auto expected = RLE_AC(zigzag<int>(block));
+        BOOST_CHECK(expected == RLE_AC(block));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(encodeBlock_matches_category_coding) {
+    auto& dc_table = standardCodeTable(StandardTable::LuminanceDC);
+    auto& ac_table = standardCodeTable(StandardTable::LuminanceAC);
+
+    srand(7);
+    int previous_dc = 0;
+    int expected_previous_dc = 0;
+    for (int n = 0; n < 200; ++n) {
+        matrix<int> block(8, 8);
+        for (auto i = 0U; i < 64; ++i)
+            block.data()[i] = (rand() % 4 == 0) ? rand() % 200 - 100 : 0;
+        block(0, 0) = rand() % 2000 - 1000;
+
+        // the step by step way: DC difference, RLE, category coding, then table lookups
+        Bitstream expected;
+        auto rle = RLE_AC(block);
+        rle[0].value -= expected_previous_dc;
+        expected_previous_dc = block(0, 0);
+
+        auto codes = encode_category(rle);
+        for (auto it = begin(codes); it != end(codes); ++it) {
+            auto& table = (it == begin(codes)) ? dc_table : ac_table;
+            expected.push_back_LSB_mode(table.code(it->symbol), table.length(it->symbol));
+            expected.push_back_LSB_mode(it->code, it->length());
+        }
+
+        Bitstream stream;
+        encodeBlock(&block(0, 0), block.size2(), previous_dc, dc_table, ac_table, stream);
+
+        BOOST_CHECK(stream == expected);
+        BOOST_CHECK_EQUAL(previous_dc, block(0, 0));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(blockBits_counts_encodeBlock) {
+    auto& dc_table = standardCodeTable(StandardTable::ChrominanceDC);
+    auto& ac_table = standardCodeTable(StandardTable::ChrominanceAC);
+
+    srand(11);
+    int previous_dc = 0, counted_previous_dc = 0, token_previous_dc = 0;
+    for (int n = 0; n < 200; ++n) {
+        matrix<int> block(8, 8);
+        for (auto i = 0U; i < 64; ++i)
+            block.data()[i] = (rand() % (1 + n % 6) == 0) ? rand() % 600 - 300 : 0;
+        block(0, 0) = rand() % 2000 - 1000;
+
+        Bitstream stream;
+        encodeBlock(&block(0, 0), block.size2(), previous_dc, dc_table, ac_table, stream);
+
+        BOOST_CHECK_EQUAL(blockBits(&block(0, 0), block.size2(), counted_previous_dc, dc_table, ac_table), stream.size());
+        BOOST_CHECK_EQUAL(counted_previous_dc, block(0, 0));
+
+        // the category codes of the step by step way
+        auto rle = RLE_AC(block);
+        rle[0].value -= token_previous_dc;
+        token_previous_dc = block(0, 0);
+        BOOST_CHECK_EQUAL(blockBits(encode_category(rle), dc_table, ac_table), stream.size());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(encodedBits_counts_encodeBlock) {
+    // blocks from sparse to dense, all of them counted into histograms and coded
+    srand(13);
+    std::vector<matrix<int>> blocks;
+    SymbolHistogram dc_histogram, ac_histogram;
+    int previous_dc = 0;
+    for (int n = 0; n < 300; ++n) {
+        matrix<int> block(8, 8);
+        for (auto i = 0U; i < 64; ++i)
+            block.data()[i] = (rand() % (1 + n % 8) == 0) ? rand() % 400 - 200 : 0;
+        block(0, 0) = rand() % 1600 - 800;
+        scanBlockSymbols(&block(0, 0), block.size2(), previous_dc,
+                         [&](uint8_t symbol, CategoryBits) { ++dc_histogram[symbol]; },
+                         [&](uint8_t symbol, CategoryBits) { ++ac_histogram[symbol]; });
+        blocks.push_back(block);
+    }
+
+    auto written_bits = [&](const CodeTable& dc_table, const CodeTable& ac_table) {
+        BitWriter writer(0, false);
+        int previous = 0;
+        for (const auto& block : blocks)
+            encodeBlock(&block(0, 0), block.size2(), previous, dc_table, ac_table, writer);
+        return static_cast<uint64_t>(writer.size());
+    };
+
+    // the standard tables and the ones generated for these symbols
+    auto& standard_dc = standardCodeTable(StandardTable::LuminanceDC);
+    auto& standard_ac = standardCodeTable(StandardTable::LuminanceAC);
+    BOOST_CHECK_EQUAL(encodedBits(dc_histogram, standard_dc) + encodedBits(ac_histogram, standard_ac),
+                      written_bits(standard_dc, standard_ac));
+
+    auto generated_dc = generateHuffmanCode(dc_histogram).first;
+    auto generated_ac = generateHuffmanCode(ac_histogram).first;
+    const auto generated_bits = encodedBits(dc_histogram, generated_dc) + encodedBits(ac_histogram, generated_ac);
+    BOOST_CHECK_EQUAL(generated_bits, written_bits(generated_dc, generated_ac));
+    BOOST_CHECK(generated_bits < written_bits(standard_dc, standard_ac));
+}
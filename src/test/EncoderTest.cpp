@@ -0,0 +1,402 @@
+#include "test/unittest.hpp"
+
+#include <algorithm>
+#include <fstream>
+#include <stdexcept>
+#include <omp.h>
+
+#include "Encoder.hpp"
+
+BOOST_AUTO_TEST_CASE(encoder_reuse) {
+    // bigger and smaller images one after another through the same encoder
+    const char* images[] = { "res/tester_text_32x32.ppm", "res/tester_RGB_26x19.ppm", "res/tester_green_blue_8x12.ppm",
+                             "res/tester_text_32x32.ppm" };
+    Image::HuffmanMode modes[] = { Image::Optimized, Image::Standard, Image::Sampled };
+
+    Encoder encoder(32, 32);
+    MemorySink reused;
+    for (auto mode : modes) {
+        for (uint restart_interval : { 0, 1 }) {
+            for (bool interleaved : { true, false }) {
+                for (auto ppm : images) {
+                    auto img = loadPPM(ppm);
+
+                    EncoderOptions options;
+                    options.huffman_mode = mode;
+                    options.restart_interval = restart_interval;
+                    options.interleaved = interleaved;
+
+                    reused.clear();
+                    encoder.encode(img, reused, options);
+
+                    MemorySink single;
+                    img.writeJPEG(single, mode, nullptr, restart_interval, interleaved);
+                    BOOST_CHECK(reused.data() == single.data());
+                }
+            }
+        }
+    }
+
+    auto script = defaultScanScript();
+    EncoderOptions progressive;
+    progressive.scan_script = &script;
+    for (auto ppm : images) {
+        auto img = loadPPM(ppm);
+
+        reused.clear();
+        encoder.encode(img, reused, progressive);
+
+        MemorySink single;
+        img.writeJPEG(single, Image::Optimized, nullptr, 0, true, &script);
+        BOOST_CHECK(reused.data() == single.data());
+    }
+}
+
+BOOST_AUTO_TEST_CASE(encoder_profile_tables) {
+    auto img = loadPPM("res/tester_RGB_26x19.ppm");
+
+    TableProfile standard;
+    standard.Y_DC = standardSymbolsPerLength(StandardTable::LuminanceDC);
+    standard.Y_AC = standardSymbolsPerLength(StandardTable::LuminanceAC);
+    standard.C_DC = standardSymbolsPerLength(StandardTable::ChrominanceDC);
+    standard.C_AC = standardSymbolsPerLength(StandardTable::ChrominanceAC);
+    auto trained = trainTableProfile(img.collectStatistics());
+
+    // the cached tables change with the profile
+    Encoder encoder;
+    auto encode = [&](Image::HuffmanMode mode, const TableProfile* profile) {
+        EncoderOptions options;
+        options.huffman_mode = mode;
+        options.table_profile = profile;
+
+        MemorySink sink;
+        encoder.encode(img, sink, options);
+        return sink.data();
+    };
+    auto standard_jpeg = encode(Image::Standard, nullptr);
+    BOOST_CHECK(encode(Image::Profile, &standard) == standard_jpeg);
+    auto trained_jpeg = encode(Image::Profile, &trained);
+    BOOST_CHECK(trained_jpeg != standard_jpeg);
+    BOOST_CHECK(encode(Image::Profile, &standard) == standard_jpeg);
+    BOOST_CHECK(encode(Image::Profile, &trained) == trained_jpeg);
+
+    // writeJPEG leaves the image as it is
+    auto copy = img;
+    img.writeJPEG("encoder_profile_test.jpg", Image::Profile, &trained);
+    BOOST_CHECK(img.colorSpace() == Image::RGB);
+    for (uint y = 0; y < img.height; ++y) {
+        for (uint x = 0; x < img.width; ++x)
+            BOOST_CHECK(img.R(y, x) == copy.R(y, x) && img.G(y, x) == copy.G(y, x) && img.B(y, x) == copy.B(y, x));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(encoder_options) {
+    auto img = loadPPM("res/tester_RGB_26x19.ppm");
+
+    auto encode = [&](const EncoderOptions& options) {
+        MemorySink sink;
+        img.writeJPEG(sink, options);
+        return sink.data();
+    };
+    // the Y sampling factors in the SOF0 (or SOF2) segment after marker, length, precision, size and component count
+    auto luma_sampling = [](const std::vector<uint8_t>& jpeg, uint8_t sof_marker = 0xC0) {
+        const uint8_t marker[] = { 0xFF, sof_marker };
+        auto sof = std::search(jpeg.begin(), jpeg.end(), std::begin(marker), std::end(marker));
+        BOOST_REQUIRE(sof + 12 < jpeg.end());
+        return sof[11];
+    };
+
+    // the defaults are the shorthand parameters
+    MemorySink shorthand;
+    img.writeJPEG(shorthand);
+    auto defaults = encode(EncoderOptions());
+    BOOST_CHECK(defaults == shorthand.data());
+    BOOST_CHECK_EQUAL(luma_sampling(defaults), 0x22);
+
+    // every subsampling with its MCU layout, in all scan modes
+    auto script = defaultScanScript();
+    const Image::SubsamplingMode modes[] = { Image::S444, Image::S422, Image::S411, Image::S420, Image::S420_m, Image::S420_lm };
+    const uint8_t factors[] = { 0x11, 0x21, 0x41, 0x22, 0x22, 0x22 };
+    std::vector<std::vector<uint8_t>> jpegs;
+    for (int i = 0; i < 6; ++i) {
+        EncoderOptions options;
+        options.subsampling = modes[i];
+        auto jpeg = encode(options);
+        BOOST_CHECK_EQUAL(luma_sampling(jpeg), factors[i]);
+        BOOST_CHECK(jpeg.size() <= maxEncodedSize(26, 19, options));
+        jpegs.push_back(jpeg);
+
+        options.restart_interval = 1;
+        options.interleaved = false;
+        BOOST_CHECK(encode(options).size() <= maxEncodedSize(26, 19, options));
+        options.scan_script = &script;
+        BOOST_CHECK_EQUAL(luma_sampling(encode(options), 0xC2), factors[i]);
+    }
+    BOOST_CHECK(jpegs[4] == defaults);
+    for (int i = 0; i < 4; ++i) {
+        for (int j = i + 1; j < 4; ++j)
+            BOOST_CHECK(jpegs[i] != jpegs[j]);
+    }
+
+    // the reference DCT kernels give (almost) the same coefficients
+    EncoderOptions matrix_dct;
+    matrix_dct.dct_mode = Image::Matrix;
+    EncoderOptions direct_dct;
+    direct_dct.dct_mode = Image::Simple;
+    auto matrix_jpeg = encode(matrix_dct);
+    BOOST_CHECK(encode(direct_dct).size() == matrix_jpeg.size());
+    BOOST_CHECK(matrix_jpeg.size() > defaults.size() * 9 / 10 && matrix_jpeg.size() < defaults.size() * 11 / 10);
+
+    // finer quantization gives a bigger file
+    EncoderOptions fine;
+    fine.quantization_y.fill(1);
+    fine.quantization_c.fill(1);
+    BOOST_CHECK(encode(fine).size() > defaults.size());
+
+    // the thread count is only changed for the encode
+    EncoderOptions single_thread;
+    single_thread.threads = 1;
+    const int threads = omp_get_max_threads();
+    BOOST_CHECK(encode(single_thread) == defaults);
+    BOOST_CHECK_EQUAL(omp_get_max_threads(), threads);
+
+    // invalid options fail before anything is written
+    EncoderOptions zero_table;
+    zero_table.quantization_c[5] = 0;
+    MemorySink sink;
+    BOOST_CHECK_THROW(img.writeJPEG(sink, zero_table), std::invalid_argument);
+    EncoderOptions long_interval;
+    long_interval.restart_interval = 65536;
+    BOOST_CHECK_THROW(img.writeJPEG(sink, long_interval), std::invalid_argument);
+    EncoderOptions no_profile;
+    no_profile.huffman_mode = Image::Profile;
+    BOOST_CHECK_THROW(img.writeJPEG(sink, no_profile), std::invalid_argument);
+    BOOST_CHECK_EQUAL(sink.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(encoder_mcu_count) {
+    // sizes that aren't whole MCUs of every layout: the scan has as many MCUs as a decoder reads from the SOF size
+    {
+        std::ofstream out("tester_gradient_17x9.ppm");
+        out << "P3 17 9 255\n";
+        for (int i = 0; i < 17 * 9; ++i)
+            out << i % 17 * 15 << ' ' << i / 17 * 28 << ' ' << (i * 5) % 256 << '\n';
+    }
+    const char* images[] = { "tester_gradient_17x9.ppm", "res/tester_RGB_26x19.ppm", "res/tester_green_blue_8x12.ppm",
+                             "res/tester_red_4x4.ppm" };
+    const Image::SubsamplingMode modes[] = { Image::S444, Image::S422, Image::S411, Image::S420 };
+    const uint mcu_widths[] = { 8, 16, 32, 16 }, mcu_heights[] = { 8, 8, 8, 16 };
+
+    for (auto ppm : images) {
+        auto img = loadPPM(ppm);
+        for (int i = 0; i < 4; ++i) {
+            // with a restart marker after every MCU
+            EncoderOptions options;
+            options.subsampling = modes[i];
+            options.restart_interval = 1;
+            MemorySink sink;
+            img.writeJPEG(sink, options);
+
+            const uint8_t sos[] = { 0xFF, 0xDA };
+            const auto& jpeg = sink.data();
+            auto scan = std::search(jpeg.begin(), jpeg.end(), std::begin(sos), std::end(sos));
+            BOOST_REQUIRE(scan != jpeg.end());
+            uint markers = 0;
+            for (auto it = scan; it + 1 != jpeg.end(); ++it)
+                markers += *it == 0xFF && it[1] >= 0xD0 && it[1] <= 0xD7;
+
+            const uint mcus = (img.real_width + mcu_widths[i] - 1) / mcu_widths[i] * ((img.real_height + mcu_heights[i] - 1) / mcu_heights[i]);
+            BOOST_CHECK_EQUAL(markers + 1, mcus);
+        }
+    }
+}
+
+BOOST_AUTO_TEST_CASE(invalid_options_keep_file) {
+    // a file that is there already isn't truncated before the options are checked
+    auto img = loadPPM("res/tester_RGB_26x19.ppm");
+    img.writeJPEG("tester_keep.jpg");
+    auto file_size = [] {
+        std::ifstream in("tester_keep.jpg", std::ios::binary | std::ios::ate);
+        return static_cast<size_t>(in.tellg());
+    };
+    const auto size = file_size();
+    BOOST_REQUIRE(size > 0);
+
+    EncoderOptions invalid;
+    invalid.quality = 0;
+    BOOST_CHECK_THROW(img.writeJPEG("tester_keep.jpg", invalid), std::invalid_argument);
+    BOOST_CHECK_EQUAL(file_size(), size);
+
+    // only the AC of Y, the DC scan is missing
+    ScanScript broken = { { { 0 }, 1, 63, 0, 0 } };
+    BOOST_CHECK_THROW(img.writeJPEG("tester_keep.jpg", Image::Optimized, nullptr, 0, true, &broken), std::invalid_argument);
+    BOOST_CHECK_EQUAL(file_size(), size);
+}
+
+BOOST_AUTO_TEST_CASE(encoder_options_subsampled_input) {
+    // an I420 frame keeps its chroma planes, other layouts don't fit them
+    const uint width = 26, height = 19;
+    std::vector<Byte> y(width * height), u(13 * 10), v(13 * 10);
+    for (size_t i = 0; i < y.size(); ++i)
+        y[i] = static_cast<Byte>(i * 7);
+    for (size_t i = 0; i < u.size(); ++i) {
+        u[i] = static_cast<Byte>(i * 3);
+        v[i] = static_cast<Byte>(255 - i * 5);
+    }
+    auto img = loadI420(y.data(), width, u.data(), 13, v.data(), 13, width, height);
+
+    MemorySink defaults, point_sampled;
+    img.writeJPEG(defaults);
+    EncoderOptions options;
+    options.subsampling = Image::S420;
+    img.writeJPEG(point_sampled, options);
+    BOOST_CHECK(defaults.data() == point_sampled.data());
+
+    MemorySink sink;
+    options.subsampling = Image::S444;
+    BOOST_CHECK_THROW(img.writeJPEG(sink, options), std::invalid_argument);
+    BOOST_CHECK_EQUAL(sink.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(quality_scaling) {
+    const auto& luminance = standardLuminanceTable();
+
+    // 50 is the table, 100 all ones, 75 half of it and 1 the coarsest possible
+    BOOST_CHECK(scaleQuantizationTable(luminance, 50) == luminance);
+    for (auto value : scaleQuantizationTable(luminance, 100))
+        BOOST_CHECK_EQUAL(value, 1);
+    auto half = scaleQuantizationTable(luminance, 75);
+    BOOST_CHECK_EQUAL(half[0], 8);
+    BOOST_CHECK_EQUAL(half[63], 50);
+    auto coarsest = scaleQuantizationTable(luminance, 1);
+    BOOST_CHECK_EQUAL(coarsest[0], 255);
+    BOOST_CHECK_EQUAL(scaleQuantizationTable(luminance, 10)[2], 50);
+
+    // lower qualities give smaller files, the cached tables of every quality give the same file as a new encoder
+    auto img = loadPPM("res/tester_RGB_26x19.ppm");
+    Encoder encoder;
+    auto encode = [&](Encoder& with, int quality) {
+        EncoderOptions options;
+        options.quality = quality;
+        MemorySink sink;
+        with.encode(img, sink, options);
+        return sink.data();
+    };
+
+    std::vector<uint8_t> previous;
+    for (int quality : { 10, 50, 90, 100 }) {
+        auto jpeg = encode(encoder, quality);
+        BOOST_CHECK(jpeg.size() > previous.size());
+        previous = jpeg;
+    }
+    for (int quality : { 90, 10, 100, 50 }) {
+        Encoder fresh;
+        BOOST_CHECK(encode(encoder, quality) == encode(fresh, quality));
+    }
+
+    MemorySink defaults;
+    img.writeJPEG(defaults);
+    BOOST_CHECK(encode(encoder, 50) == defaults.data());
+
+    EncoderOptions invalid;
+    invalid.quality = 0;
+    MemorySink sink;
+    BOOST_CHECK_THROW(encoder.encode(img, sink, invalid), std::invalid_argument);
+    invalid.quality = 101;
+    BOOST_CHECK_THROW(encoder.encode(img, sink, invalid), std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(rate_control) {
+    auto img = loadPPM("res/tester_text_32x32.ppm");
+    Encoder encoder;
+
+    auto encode = [&](const EncoderOptions& options) {
+        MemorySink sink;
+        encoder.encode(img, sink, options);
+        return sink.data();
+    };
+
+    for (auto mode : { Image::Optimized, Image::Standard }) {
+        EncoderOptions fixed;
+        fixed.huffman_mode = mode;
+        fixed.quality = 100;
+        const auto full_size = encode(fixed).size();
+        fixed.quality = 1;
+        const auto smallest_size = encode(fixed).size();
+        BOOST_REQUIRE(smallest_size < full_size);
+
+        EncoderOptions options;
+        options.huffman_mode = mode;
+        options.quality = 100;
+        for (size_t target : { full_size, (smallest_size + full_size) / 2, smallest_size + 40 }) {
+            options.target_size = target;
+            auto jpeg = encode(options);
+            BOOST_CHECK(jpeg.size() <= target);
+
+            // the same jpeg as without rate control at the chosen quality
+            fixed.quality = encoder.lastQuality();
+            BOOST_CHECK(encode(fixed) == jpeg);
+        }
+        options.target_size = full_size;
+        encode(options);
+        BOOST_CHECK_EQUAL(encoder.lastQuality(), 100);
+
+        // a target below the smallest file gives quality 1
+        options.target_size = 10;
+        BOOST_CHECK_EQUAL(encode(options).size(), smallest_size);
+        BOOST_CHECK_EQUAL(encoder.lastQuality(), 1);
+    }
+
+    // progressive scans are estimated like baseline ones, the jpeg fits all the same
+    auto script = defaultScanScript();
+    EncoderOptions progressive;
+    progressive.scan_script = &script;
+    progressive.quality = 100;
+    const auto full_size = encode(progressive).size();
+    progressive.target_size = full_size * 2 / 3;
+    BOOST_CHECK(encode(progressive).size() <= progressive.target_size);
+    BOOST_CHECK(encoder.lastQuality() < 100);
+}
+
+BOOST_AUTO_TEST_CASE(rate_control_reused_encoder) {
+    // tall enough that only every 4th MCU row is sampled for the estimates
+    const uint width = 48, height = 1024;
+    auto frame = [&](int seed, int brightness) {
+        std::vector<Byte> y(width * height), u(width / 2 * height / 2), v(u.size());
+        for (size_t i = 0; i < y.size(); ++i)
+            y[i] = static_cast<Byte>(brightness + ((i * seed) >> 3) % 48 + (i / width % 16 == 0) * 40);
+        for (size_t i = 0; i < u.size(); ++i) {
+            u[i] = static_cast<Byte>(128 + (i * seed) % 31);
+            v[i] = static_cast<Byte>(255 - brightness / 2 - (i * 3) % 17);
+        }
+        return loadI420(y.data(), width, u.data(), width / 2, v.data(), width / 2, width, height);
+    };
+    auto img = frame(7, 10);
+    auto other = frame(13, 200);
+
+    EncoderOptions fixed;
+    fixed.quality = 100;
+    MemorySink sink;
+    Encoder encoder;
+    encoder.encode(img, sink, fixed);
+    const auto full_size = sink.size();
+
+    // the estimates only depend on the image, not on what the encoder did before
+    EncoderOptions options;
+    options.quality = 100;
+    for (size_t target = full_size / 10; target < full_size; target += full_size / 10) {
+        options.target_size = target;
+
+        Encoder fresh;
+        MemorySink fresh_jpeg;
+        fresh.encode(img, fresh_jpeg, options);
+
+        sink.clear();
+        encoder.encode(other, sink, fixed);
+        MemorySink reused_jpeg;
+        encoder.encode(img, reused_jpeg, options);
+
+        BOOST_CHECK_EQUAL(encoder.lastQuality(), fresh.lastQuality());
+        BOOST_CHECK(reused_jpeg.data() == fresh_jpeg.data());
+    }
+}
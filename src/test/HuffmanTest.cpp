@@ -1,6 +1,7 @@
 #include "test/unittest.hpp"
 
 #include <vector>
+#include <random>
 
 #include "BitstreamGeneric.hpp"
 #include "Huffman.hpp"
@@ -38,10 +39,11 @@ BOOST_AUTO_TEST_CASE(test_tree_right_growing) {
     auto pair = generateHuffmanCode(text);
     SymbolCodeMap code_map = pair.first;
 
-    BOOST_CHECK(equals(code_map[22], Bitstream({ 1, 0, 0 })));
-    BOOST_CHECK(equals(code_map[2], Bitstream({ 1, 0, 1 })));
+    // symbols with the same code length get their codes in ascending order
+    BOOST_CHECK(equals(code_map[2], Bitstream({ 1, 0, 0 })));
+    BOOST_CHECK(equals(code_map[3], Bitstream({ 1, 0, 1 })));
+    BOOST_CHECK(equals(code_map[22], Bitstream({ 1, 1, 0 })));
     BOOST_CHECK(equals(code_map[33], Bitstream({ 1, 1, 1, 0 })));
-    BOOST_CHECK(equals(code_map[3], Bitstream({ 1, 1, 0 })));
     BOOST_CHECK(equals(code_map[5], Bitstream({ 0, 0 })));
     BOOST_CHECK(equals(code_map[7], Bitstream({ 0, 1 })));
     BOOST_CHECK_EQUAL(code_map.size(), 6);
@@ -82,4 +84,175 @@ BOOST_AUTO_TEST_CASE(decoding2) {
 
     vector<int> decoded = huffmanDecode(encoded, code_map);
     BOOST_CHECK(text == decoded);
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE(histogram_code_lengths) {
+    vector<int> text{ 5, 5, 5, 5, 5, 4, 4, 4, 4, 2, 2, 1, 200, 200, 200 };
+
+    SymbolHistogram histogram;
+    for (auto symbol : text)
+        ++histogram[symbol];
+
+    auto from_text = generateHuffmanCode(text).first;
+    auto from_histogram = generateHuffmanCode(histogram).first;
+
+    for (auto symbol = 0; symbol < 256; ++symbol) {
+        if (from_text.count(symbol))
+            BOOST_CHECK_EQUAL(from_histogram.length(symbol), from_text[symbol].length);
+        else
+            BOOST_CHECK_EQUAL(from_histogram.length(symbol), 0);
+    }
+
+    // only one symbol
+    SymbolHistogram single;
+    single[17] = 3;
+    auto code_table = generateHuffmanCode(single).first;
+    BOOST_CHECK_EQUAL(code_table.length(17), 1);
+    BOOST_CHECK_EQUAL(code_table.code(17), 0);
+}
+
+BOOST_AUTO_TEST_CASE(histogram_code_in_reused_storage) {
+    // big and small alphabets one after another through the same storage give the codes of fresh storage
+    HuffmanScratch scratch;
+    CodeTable code_table;
+    SymbolsPerLength symbols;
+    for (int n : { 256, 3, 1, 162, 12, 256 }) {
+        SymbolHistogram histogram;
+        for (int symbol = 0; symbol < n; ++symbol)
+            histogram[(symbol * 37 + n) % 256] = 1 + (symbol * symbol * 7919U) % 1000;
+
+        generateHuffmanCode(histogram, scratch, code_table, symbols);
+        auto fresh = generateHuffmanCode(histogram);
+        BOOST_CHECK(symbols == fresh.second);
+        BOOST_CHECK(code_table.packed == fresh.first.packed);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(code_table_matches_code_map) {
+    vector<int> text{ 0, 0, 0, 0, 0, 0, 1, 1, 1, 17, 17, 34, 34, 34, 34, 255, 128, 128, 0xF0 };
+
+    auto symbols = generateHuffmanCode(text).second;
+    auto code_map = generateCodes(symbols);
+    auto code_table = generateCodeTable(symbols);
+
+    for (auto& entry : code_map) {
+        auto& code = entry.second;
+        BOOST_CHECK_EQUAL(code_table.length(entry.first), code.length);
+        BOOST_CHECK_EQUAL(code_table.code(entry.first), code.code >> (32 - code.length));
+    }
+
+    vector<uint8_t> bytes(begin(text), end(text));
+    BOOST_CHECK(huffmanEncode(bytes, code_table) == huffmanEncode(text, code_map));
+}
+
+BOOST_AUTO_TEST_CASE(standard_tables) {
+    // DC tables cover the categories 0..11, AC tables every run/category symbol, EOB and ZRL
+    for (auto table : { StandardTable::LuminanceDC, StandardTable::ChrominanceDC }) {
+        auto& code_table = standardCodeTable(table);
+        for (int category = 0; category <= 11; ++category)
+            BOOST_CHECK(code_table.length(category) > 0);
+        BOOST_CHECK_EQUAL(code_table.length(12), 0);
+    }
+
+    for (auto table : { StandardTable::LuminanceAC, StandardTable::ChrominanceAC }) {
+        auto& code_table = standardCodeTable(table);
+        BOOST_CHECK(code_table.length(0x00) > 0);
+        BOOST_CHECK(code_table.length(0xF0) > 0);
+        for (int run = 0; run < 16; ++run)
+            for (int category = 1; category <= 10; ++category)
+                BOOST_CHECK(code_table.length(static_cast<uint8_t>((run << 4) | category)) > 0);
+
+        auto& symbols = standardSymbolsPerLength(table);
+        BOOST_CHECK_EQUAL(symbols.size(), 17);
+        size_t count = 0;
+        for (auto& list : symbols)
+            count += list.size();
+        BOOST_CHECK_EQUAL(count, 162);
+    }
+
+    // a few codes from Table K.5
+    auto& luminance_ac = standardCodeTable(StandardTable::LuminanceAC);
+    BOOST_CHECK_EQUAL(luminance_ac.code(0x00), 0xA);   // EOB: 1010
+    BOOST_CHECK_EQUAL(luminance_ac.length(0x00), 4);
+    BOOST_CHECK_EQUAL(luminance_ac.code(0xF0), 0x7F9); // ZRL: 11111111001
+    BOOST_CHECK_EQUAL(luminance_ac.length(0xF0), 11);
+    BOOST_CHECK_EQUAL(luminance_ac.code(0x01), 0x0);   // 00
+    BOOST_CHECK_EQUAL(luminance_ac.length(0x01), 2);
+
+    auto& luminance_dc = standardCodeTable(StandardTable::LuminanceDC);
+    BOOST_CHECK_EQUAL(luminance_dc.code(0), 0x0);      // 00
+    BOOST_CHECK_EQUAL(luminance_dc.length(0), 2);
+    BOOST_CHECK_EQUAL(luminance_dc.code(11), 0x1FE);   // 111111110
+    BOOST_CHECK_EQUAL(luminance_dc.length(11), 9);
+}
+
+BOOST_AUTO_TEST_CASE(reserved_symbols_get_codes) {
+    // statistics of a small sample: only a few symbols were seen
+    SymbolHistogram dc, ac;
+    dc[3] = 500;
+    dc[4] = 200;
+    ac[0x00] = 1000;
+    ac[0x01] = 800;
+    ac[0x12] = 30;
+
+    reserveDCSymbols(dc);
+    reserveACSymbols(ac);
+
+    auto dc_table = generateHuffmanCode(dc).first;
+    auto ac_table = generateHuffmanCode(ac).first;
+
+    for (int category = 0; category <= 11; ++category)
+        BOOST_CHECK(dc_table.length(category) > 0);
+    for (int run = 0; run < 16; ++run)
+        for (int category = 1; category <= 10; ++category)
+            BOOST_CHECK(ac_table.length(static_cast<uint8_t>((run << 4) | category)) > 0);
+    BOOST_CHECK(ac_table.length(0xF0) > 0);
+
+    // the seen symbols still get the short codes
+    BOOST_CHECK(ac_table.length(0x00) <= 2);
+    BOOST_CHECK(ac_table.length(0x01) <= 2);
+    BOOST_CHECK(dc_table.length(3) <= dc_table.length(0));
+}
+
+BOOST_AUTO_TEST_CASE(decoding_long_codes) {
+    // fibonacci frequencies give the longest possible codes, most of them miss the lookahead table
+    vector<int> text;
+    int a = 1, b = 1;
+    for (int symbol = 0; symbol < 24; ++symbol) {
+        for (int i = 0; i < a; ++i)
+            text.push_back(symbol);
+        auto next = a + b;
+        a = b;
+        b = next;
+    }
+    std::shuffle(begin(text), end(text), std::mt19937(1));
+
+    auto pair = generateHuffmanCode(text);
+    BOOST_CHECK(pair.second[16].size() > 0);
+
+    auto encoded = huffmanEncode(text, pair.first);
+    BOOST_CHECK(huffmanDecode(encoded, pair.second) == text);
+    BOOST_CHECK(huffmanDecode(encoded, pair.first) == text);
+}
+
+BOOST_AUTO_TEST_CASE(decoding_standard_table) {
+    // every symbol of the luminance AC table, codes from 2 to 16 bits
+    auto& symbols = standardSymbolsPerLength(StandardTable::LuminanceAC);
+    vector<uint8_t> text;
+    for (int round = 0; round < 3; ++round)
+        for (auto& list : symbols)
+            text.insert(end(text), begin(list), end(list));
+
+    auto encoded = huffmanEncode(text, standardCodeTable(StandardTable::LuminanceAC));
+    auto decoded = huffmanDecode(encoded, symbols);
+
+    BOOST_CHECK(vector<int>(begin(text), end(text)) == decoded);
+
+    HuffmanDecoder decoder(symbols);
+    auto eob = decoder.decode(0xA000 | 0x0FFF); // 1010 and ones
+    BOOST_CHECK_EQUAL(eob.symbol, 0x00);
+    BOOST_CHECK_EQUAL(eob.length, 4);
+    auto zrl = decoder.decode((0x7F9 << 5) | 0x1F); // 11111111001 and ones
+    BOOST_CHECK_EQUAL(zrl.symbol, 0xF0);
+    BOOST_CHECK_EQUAL(zrl.length, 11);
+    BOOST_CHECK_EQUAL(decoder.decode(0xFFFF).length, 0); // only ones isn't a code
+}
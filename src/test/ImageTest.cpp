@@ -4,6 +4,8 @@
 #include "BitstreamGeneric.hpp"
 #include "JpegSegments.hpp"
 
+#include <omp.h>
+
 BOOST_AUTO_TEST_CASE(image_loading_test) {
     auto image = loadPPM("res/tester_p3.ppm");
     BOOST_CHECK(image.R(0, 0) == 0);
@@ -350,4 +352,173 @@ BOOST_AUTO_TEST_CASE(applying_dct) {
         auto image = loadPPM("res/tester_p3.ppm");
         image.applyDCT(Image::Matrix);
     }
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE(image_yuv_loading_test) {
+    // 6x3 frame, Y is x + 10*y, U is 100 + chroma x, V is 200 + chroma y
+    const uint w = 6, h = 3;
+    std::vector<Byte> y(8 * h), u(4 * 2), v(4 * 2), uv(8 * 2), yuyv(16 * h);
+    for (auto row = 0U; row < h; ++row) {
+        for (auto x = 0U; x < w; ++x) {
+            y[row * 8 + x] = x + 10 * row;
+            yuyv[row * 16 + 2 * x] = x + 10 * row;
+        }
+    }
+    for (auto row = 0U; row < 2; ++row) {
+        for (auto x = 0U; x < 3; ++x) {
+            u[row * 4 + x] = uv[row * 8 + 2 * x] = 100 + x;
+            v[row * 4 + x] = uv[row * 8 + 2 * x + 1] = 200 + row;
+        }
+    }
+    for (auto row = 0U; row < h; ++row) {
+        for (auto x = 0U; x < 3; ++x) {
+            yuyv[row * 16 + 4 * x + 1] = 100 + x;
+            yuyv[row * 16 + 4 * x + 3] = 200 + row / 2;
+        }
+    }
+
+    auto i420 = loadI420(y.data(), 8, u.data(), 4, v.data(), 4, w, h);
+    auto nv12 = loadNV12(y.data(), 8, uv.data(), 8, w, h);
+    auto packed = loadYUYV(yuyv.data(), 16, w, h);
+
+    for (auto img : { &i420, &nv12, &packed }) {
+        BOOST_CHECK_EQUAL(img->width, 16);
+        BOOST_CHECK_EQUAL(img->height, 16);
+        BOOST_CHECK_EQUAL(img->real_width, w);
+        BOOST_CHECK_EQUAL(img->real_height, h);
+        BOOST_CHECK(img->isSubsampled());
+        BOOST_CHECK_EQUAL(img->Cb.size1(), 8);
+        BOOST_CHECK_EQUAL(img->Cb.size2(), 8);
+
+        // level shifted samples
+        BOOST_CHECK_EQUAL(img->Y(0, 0), -128);
+        BOOST_CHECK_EQUAL(img->Y(2, 5), 25 - 128);
+        BOOST_CHECK_EQUAL(img->Cb(1, 2), 102 - 128);
+        BOOST_CHECK_EQUAL(img->Cr(1, 2), 201 - 128);
+
+        // padding is filled from the border
+        BOOST_CHECK_EQUAL(img->Y(15, 15), 25 - 128);
+        BOOST_CHECK_EQUAL(img->Cb(7, 7), 102 - 128);
+        BOOST_CHECK_EQUAL(img->Cr(7, 0), 201 - 128);
+    }
+
+    // YUYV chroma rows are averaged
+    BOOST_CHECK_EQUAL(packed.Cr(0, 0), 200 - 128);
+    BOOST_CHECK_EQUAL(packed.Cr(1, 0), 201 - 128);
+
+    i420.writeJPEG("tester_i420_6x3_own_encoder.jpg");
+}
+
+// markers (0xFF followed by anything but the stuffed 0x00) behind the start of the scan
+static std::vector<uint8_t> scanMarkers(const std::vector<uint8_t>& jpeg) {
+    std::vector<uint8_t> markers;
+    size_t i = 0;
+    while (i + 1 < jpeg.size() && !(jpeg[i] == 0xFF && jpeg[i + 1] == 0xDA))
+        ++i;
+    i += 2 + ((jpeg[i + 2] << 8) | jpeg[i + 3]);
+
+    for (; i + 1 < jpeg.size(); ++i) {
+        if (jpeg[i] == 0xFF && jpeg[i + 1] != 0x00)
+            markers.push_back(jpeg[++i]);
+    }
+    return markers;
+}
+
+BOOST_AUTO_TEST_CASE(restart_intervals) {
+    // 26x19 pixels are 2x2 MCUs
+    auto encode = [](Image::HuffmanMode mode, uint restart_interval) {
+        auto img = loadPPM("res/tester_RGB_26x19.ppm");
+        MemorySink sink;
+        img.writeJPEG(sink, mode, nullptr, restart_interval);
+        return sink.data();
+    };
+
+    Image::HuffmanMode modes[] = { Image::Optimized, Image::Standard, Image::Sampled };
+    for (auto mode : modes) {
+        auto plain = encode(mode, 0);
+        BOOST_CHECK(scanMarkers(plain) == std::vector<uint8_t>({ 0xD9 }));
+
+        // RST0, RST1, RST2 between the 4 intervals
+        auto every_mcu = encode(mode, 1);
+        BOOST_CHECK(scanMarkers(every_mcu) == std::vector<uint8_t>({ 0xD0, 0xD1, 0xD2, 0xD9 }));
+        BOOST_CHECK(every_mcu.size() <= maxEncodedSize(26, 19));
+
+        auto two_mcus = encode(mode, 2);
+        BOOST_CHECK(scanMarkers(two_mcus) == std::vector<uint8_t>({ 0xD0, 0xD9 }));
+
+        // the DRI segment
+        const uint8_t dri_marker[] = { 0xFF, 0xDD };
+        auto dri = std::search(two_mcus.begin(), two_mcus.end(), std::begin(dri_marker), std::end(dri_marker));
+        BOOST_REQUIRE(dri + 6 <= two_mcus.end());
+        BOOST_CHECK_EQUAL(dri[3], 4);
+        BOOST_CHECK_EQUAL(dri[5], 2);
+    }
+
+    // a single interval is the plain scan plus the DRI segment
+    BOOST_CHECK_EQUAL(encode(Image::Standard, 4).size(), encode(Image::Standard, 0).size() + 6);
+}
+
+BOOST_AUTO_TEST_CASE(parallel_scan_matches_sequential) {
+    // with more than one thread the MCU rows are coded in parallel and put together at their bit offsets
+    auto encodeImage = [](Image img, Image::HuffmanMode mode, int threads) {
+        MemorySink sink;
+        auto previous_threads = omp_get_max_threads();
+        omp_set_num_threads(threads);
+        img.writeJPEG(sink, mode);
+        omp_set_num_threads(previous_threads);
+        return sink.data();
+    };
+    auto encode = [&](const char* ppm, Image::HuffmanMode mode, int threads) {
+        return encodeImage(loadPPM(ppm), mode, threads);
+    };
+
+    const char* images[] = { "res/tester_text_32x32.ppm", "res/tester_RGB_26x19.ppm", "res/tester_green_blue_8x12.ppm" };
+    Image::HuffmanMode modes[] = { Image::Optimized, Image::Standard };
+    for (auto ppm : images) {
+        for (auto mode : modes) {
+            auto sequential = encode(ppm, mode, 1);
+            BOOST_CHECK(encode(ppm, mode, 2) == sequential);
+            BOOST_CHECK(encode(ppm, mode, 5) == sequential);
+        }
+    }
+
+    // noise in many MCU rows, the rows end at all kinds of bit offsets
+    const uint w = 70, h = 90;
+    std::vector<Byte> y(w * h), u(w * h / 4), v(w * h / 4);
+    uint seed = 1;
+    for (auto plane : { &y, &u, &v }) {
+        for (auto& sample : *plane) {
+            seed = seed * 1103515245 + 12345;
+            sample = static_cast<Byte>(seed >> 16);
+        }
+    }
+    auto noise = loadI420(y.data(), w, u.data(), w / 2, v.data(), w / 2, w, h);
+    for (auto mode : modes) {
+        auto sequential = encodeImage(noise, mode, 1);
+        BOOST_CHECK(encodeImage(noise, mode, 3) == sequential);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(non_interleaved_scans) {
+    auto encode = [](Image::HuffmanMode mode, uint restart_interval) {
+        auto img = loadPPM("res/tester_RGB_26x19.ppm");
+        MemorySink sink;
+        img.writeJPEG(sink, mode, nullptr, restart_interval, false);
+        return sink.data();
+    };
+
+    Image::HuffmanMode modes[] = { Image::Optimized, Image::Standard, Image::Sampled };
+    for (auto mode : modes) {
+        // SOS of Cb and Cr after the Y scan
+        BOOST_CHECK(scanMarkers(encode(mode, 0)) == std::vector<uint8_t>({ 0xDA, 0xDA, 0xD9 }));
+
+        // 26x19 pixels are 4x3 Y blocks and 2x2 blocks of Cb and Cr, every block is an MCU
+        std::vector<uint8_t> expected;
+        for (int i = 0; i < 11; ++i)
+            expected.push_back(static_cast<uint8_t>(0xD0 + i % 8));
+        expected.insert(expected.end(), { 0xDA, 0xD0, 0xD1, 0xD2, 0xDA, 0xD0, 0xD1, 0xD2, 0xD9 });
+
+        auto every_block = encode(mode, 1);
+        BOOST_CHECK(scanMarkers(every_block) == expected);
+        BOOST_CHECK(every_block.size() <= maxEncodedSize(26, 19));
+    }
+}
@@ -0,0 +1,106 @@
+#include "test/unittest.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+#include "Image.hpp"
+
+static std::vector<uint8_t> readFile(const std::string& path) {
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<uint8_t>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+static std::vector<uint8_t> encodeToMemory(const std::string& ppm, Image::HuffmanMode mode) {
+    auto img = loadPPM(ppm);
+    MemorySink sink;
+    img.writeJPEG(sink, mode);
+    return sink.data();
+}
+
+BOOST_AUTO_TEST_CASE(memory_sink_matches_file) {
+    Image::HuffmanMode modes[] = { Image::Optimized, Image::Standard };
+    for (auto mode : modes) {
+        auto img = loadPPM("res/tester_text_32x32.ppm");
+        img.writeJPEG("output_sink_test.jpg", mode);
+
+        auto memory = encodeToMemory("res/tester_text_32x32.ppm", mode);
+        BOOST_CHECK(memory == readFile("output_sink_test.jpg"));
+
+        // SOI ... EOI
+        BOOST_REQUIRE(memory.size() > 4);
+        BOOST_CHECK_EQUAL(memory[0], 0xFF);
+        BOOST_CHECK_EQUAL(memory[1], 0xD8);
+        BOOST_CHECK_EQUAL(memory[memory.size() - 2], 0xFF);
+        BOOST_CHECK_EQUAL(memory[memory.size() - 1], 0xD9);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(fixed_buffer_sink) {
+    auto expected = encodeToMemory("res/tester_RGB_26x19.ppm", Image::Standard);
+
+    // the bound is enough
+    std::vector<uint8_t> buffer(maxEncodedSize(26, 19));
+    BOOST_CHECK(expected.size() <= buffer.size());
+    {
+        auto img = loadPPM("res/tester_RGB_26x19.ppm");
+        FixedBufferSink sink(buffer.data(), buffer.size());
+        img.writeJPEG(sink, Image::Standard);
+        BOOST_REQUIRE_EQUAL(sink.size(), expected.size());
+        BOOST_CHECK(std::equal(expected.begin(), expected.end(), buffer.begin()));
+    }
+
+    // one byte too few
+    {
+        auto img = loadPPM("res/tester_RGB_26x19.ppm");
+        FixedBufferSink sink(buffer.data(), expected.size() - 1);
+        BOOST_CHECK_THROW(img.writeJPEG(sink, Image::Standard), std::length_error);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(callback_sink_chunks) {
+    auto expected = encodeToMemory("res/tester_text_32x32.ppm", Image::Optimized);
+
+    const size_t chunk_sizes[] = { 1, 7, 64, 1 << 20 };
+    for (auto chunk_size : chunk_sizes) {
+        std::vector<uint8_t> received;
+        size_t calls = 0;
+        bool all_full = true;
+
+        {
+            CallbackSink sink([&](const uint8_t* data, size_t size) {
+                // only the last chunk may be smaller
+                if (received.size() + size < expected.size() && size != chunk_size)
+                    all_full = false;
+                received.insert(received.end(), data, data + size);
+                ++calls;
+            }, chunk_size);
+
+            auto img = loadPPM("res/tester_text_32x32.ppm");
+            img.writeJPEG(sink, Image::Optimized);
+        }
+
+        BOOST_CHECK(received == expected);
+        BOOST_CHECK(all_full);
+        BOOST_CHECK_EQUAL(calls, (expected.size() + chunk_size - 1) / chunk_size);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(file_sink_buffering) {
+    std::vector<uint8_t> data(200000);
+    for (auto i = 0U; i < data.size(); ++i)
+        data[i] = static_cast<uint8_t>(i * 7);
+
+    // small writes are buffered, the large one goes past the buffer
+    {
+        FileSink sink("output_sink_test.bin");
+        sink.write(data.data(), 10);
+        sink.write(data.data() + 10, 20);
+        sink.write(data.data() + 30, 150000);
+        sink.write(data.data() + 150030, 49970);
+        sink.finish();
+    }
+    BOOST_CHECK(readFile("output_sink_test.bin") == data);
+
+    BOOST_CHECK_THROW(FileSink("does_not_exist/output_sink_test.bin"), std::runtime_error);
+}
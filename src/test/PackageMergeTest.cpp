@@ -41,4 +41,41 @@ BOOST_AUTO_TEST_CASE(package_merge_test) {
     length_three = vector<int>{{ 1, 7 }};
     BOOST_CHECK_EQUAL_COLLECTIONS(begin(length_two),   end(length_two),   begin(code_lengths[2]), end(code_lengths[2]));
     BOOST_CHECK_EQUAL_COLLECTIONS(begin(length_three), end(length_three), begin(code_lengths[3]), end(code_lengths[3]));
-}
\ No newline at end of file
+}
+BOOST_AUTO_TEST_CASE(package_merge_length_limit_test) {
+    // fibonacci frequencies give a maximally deep huffman tree (one symbol per level)
+    vector<Symbol> symbols;
+    int a = 1, b = 1;
+    for (int i = 0; i < 20; ++i) {
+        symbols.push_back(Symbol(i, a));
+        auto c = a + b;
+        a = b;
+        b = c;
+    }
+
+    // unlimited the two rarest symbols get length 19
+    auto unlimited = package_merge(symbols, 19);
+    BOOST_CHECK_EQUAL(unlimited[19].size(), 2);
+
+    // limited to 15 bits: no longer codes and the kraft sum is exactly 1
+    auto limited = package_merge(symbols, 15);
+    BOOST_CHECK_EQUAL(limited.size(), 17);
+
+    double kraft_sum = 0;
+    size_t num_symbols = 0;
+    for (auto length = 1U; length < limited.size(); ++length) {
+        if (length > 15)
+            BOOST_CHECK(limited[length].empty());
+        kraft_sum += limited[length].size() / double(1 << length);
+        num_symbols += limited[length].size();
+    }
+    BOOST_CHECK_EQUAL(num_symbols, 20);
+    BOOST_CHECK_CLOSE(kraft_sum, 1., 1e-9);
+
+    // all 256 byte symbols fit into 8 bits
+    vector<Symbol> all_bytes;
+    for (int i = 0; i < 256; ++i)
+        all_bytes.push_back(Symbol(i, 1 + i * i));
+    auto code_lengths = package_merge(all_bytes, 8);
+    BOOST_CHECK_EQUAL(code_lengths[8].size(), 256);
+}
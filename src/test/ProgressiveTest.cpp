@@ -0,0 +1,105 @@
+#include "test/unittest.hpp"
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "Image.hpp"
+#include "Encoder.hpp"
+#include "Progressive.hpp"
+
+BOOST_AUTO_TEST_CASE(scan_script_checks) {
+    BOOST_CHECK_NO_THROW(checkScanScript(defaultScanScript()));
+    BOOST_CHECK_EQUAL(defaultScanScript().size(), 10);
+
+    auto script = parseScanScript("0 1 2: 0 0 0 1; 0: 1 63 0 0; 1: 1 63 0 0; 2: 1 63 0 0; 0 1 2: 0 0 1 0");
+    BOOST_REQUIRE_EQUAL(script.size(), 5);
+    BOOST_CHECK(script[0].components == std::vector<int>({ 0, 1, 2 }));
+    BOOST_CHECK_EQUAL(script[1].spectral_end, 63);
+    BOOST_CHECK_EQUAL(script[4].approximation_high, 1);
+
+    // syntax
+    BOOST_CHECK_THROW(parseScanScript("0 1 2 0 0 0 0"), std::invalid_argument);
+    BOOST_CHECK_THROW(parseScanScript("0 1 2: 0 0 0"), std::invalid_argument);
+    BOOST_CHECK_THROW(parseScanScript("0 x: 0 0 0 0"), std::invalid_argument);
+
+    // AC before DC, AC of more than one component, a missing chroma AC scan, a refinement of more than one bit
+    BOOST_CHECK_THROW(parseScanScript("0: 1 63 0 0; 0 1 2: 0 0 0 0; 1: 1 63 0 0; 2: 1 63 0 0"), std::invalid_argument);
+    BOOST_CHECK_THROW(parseScanScript("0 1 2: 0 0 0 0; 0 1: 1 63 0 0; 2: 1 63 0 0"), std::invalid_argument);
+    BOOST_CHECK_THROW(parseScanScript("0 1 2: 0 0 0 0; 0: 1 63 0 0; 1: 1 63 0 0"), std::invalid_argument);
+    BOOST_CHECK_THROW(parseScanScript("0 1 2: 0 0 0 2; 0 1 2: 0 0 2 0; 0: 1 63 0 0; 1: 1 63 0 0; 2: 1 63 0 0"),
+                      std::invalid_argument);
+}
+
+BOOST_AUTO_TEST_CASE(progressive_output) {
+    auto encode = [](const ScanScript* script) {
+        auto img = loadPPM("res/tester_RGB_26x19.ppm");
+        MemorySink sink;
+        img.writeJPEG(sink, Image::Optimized, nullptr, 0, true, script);
+        return sink.data();
+    };
+
+    auto script = defaultScanScript();
+    auto progressive = encode(&script);
+    BOOST_REQUIRE(progressive.size() > 4);
+    BOOST_CHECK(progressive[0] == 0xFF && progressive[1] == 0xD8);
+    BOOST_CHECK(progressive[progressive.size() - 2] == 0xFF && progressive.back() == 0xD9);
+
+    const uint8_t sof0[] = { 0xFF, 0xC0 }, sof2[] = { 0xFF, 0xC2 };
+    BOOST_CHECK(std::search(progressive.begin(), progressive.end(), std::begin(sof2), std::end(sof2)) != progressive.end());
+    BOOST_CHECK(std::search(progressive.begin(), progressive.end(), std::begin(sof0), std::end(sof0)) == progressive.end());
+
+    // one SOS per scan, all but the DC refinement (plain bits) after their own DHT
+    size_t sos = 0, dht = 0;
+    for (size_t i = 0; i + 1 < progressive.size(); ++i) {
+        if (progressive[i] == 0xFF && progressive[i + 1] == 0xDA)
+            ++sos;
+        if (progressive[i] == 0xFF && progressive[i + 1] == 0xC4)
+            ++dht;
+    }
+    BOOST_CHECK_EQUAL(sos, script.size());
+    BOOST_CHECK_EQUAL(dht, script.size() - 1);
+    EncoderOptions options;
+    options.scan_script = &script;
+    BOOST_CHECK(progressive.size() <= maxEncodedSize(26, 19, options));
+
+    // the baseline jpeg is unaffected
+    auto baseline = encode(nullptr);
+    BOOST_CHECK(std::search(baseline.begin(), baseline.end(), std::begin(sof0), std::end(sof0)) != baseline.end());
+
+    // an invalid script fails before anything is written
+    ScanScript dc_only(script.begin(), script.begin() + 1);
+    auto img = loadPPM("res/tester_RGB_26x19.ppm");
+    MemorySink sink;
+    BOOST_CHECK_THROW(img.writeJPEG(sink, Image::Optimized, nullptr, 0, true, &dc_only), std::invalid_argument);
+    BOOST_CHECK_EQUAL(sink.size(), 0);
+}
+
+BOOST_AUTO_TEST_CASE(progressive_size_bound) {
+    // many scans with a segment each and bits that take more than their baseline codes: DC in two steps,
+    // then every AC coefficient of every component on its own, in two steps as well
+    std::string text = "0 1 2: 0 0 0 1; 0 1 2: 0 0 1 0";
+    for (int c = 0; c < 3; ++c) {
+        for (int k = 1; k < 64; ++k) {
+            auto band = std::to_string(k) + " " + std::to_string(k);
+            text += "; " + std::to_string(c) + ": " + band + " 0 1; " + std::to_string(c) + ": " + band + " 1 0";
+        }
+    }
+    auto script = parseScanScript(text);
+
+    for (auto ppm : { "res/tester_text_32x32.ppm", "res/tester_RGB_26x19.ppm" }) {
+        auto img = loadPPM(ppm);
+        for (auto subsampling : { Image::S444, Image::S420 }) {
+            EncoderOptions options;
+            options.subsampling = subsampling;
+            options.quantization_y.fill(1);
+            options.quantization_c.fill(1);
+            options.scan_script = &script;
+
+            // a buffer of the bound is enough
+            std::vector<uint8_t> buffer(maxEncodedSize(img.real_width, img.real_height, options));
+            FixedBufferSink sink(buffer.data(), buffer.size());
+            BOOST_CHECK_NO_THROW(img.writeJPEG(sink, options));
+            BOOST_CHECK(sink.size() > 0);
+        }
+    }
+}
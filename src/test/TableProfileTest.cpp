@@ -0,0 +1,52 @@
+#include "test/unittest.hpp"
+
+#include <fstream>
+#include <stdexcept>
+
+#include "TableProfile.hpp"
+
+BOOST_AUTO_TEST_CASE(table_profile_round_trip) {
+    SymbolStatistics statistics;
+    statistics.Y_DC[2] = 100;
+    statistics.Y_DC[3] = 50;
+    statistics.Y_AC[0x00] = 300;
+    statistics.Y_AC[0x01] = 250;
+    statistics.Y_AC[0x11] = 20;
+    statistics.C_DC[0] = 70;
+    statistics.C_AC[0x00] = 90;
+
+    auto profile = trainTableProfile(statistics);
+
+    // every symbol has a code, the frequent ones the shorter ones
+    BOOST_CHECK_EQUAL(profile.Y_AC.size(), 17);
+    auto y_ac = generateCodeTable(profile.Y_AC);
+    BOOST_CHECK(y_ac.length(0xF0) > 0);
+    BOOST_CHECK(y_ac.length(0xFA) > 0);
+    BOOST_CHECK(y_ac.length(0x01) < y_ac.length(0xFA));
+
+    saveTableProfile(profile, "table_profile_test.txt");
+    auto loaded = loadTableProfile("table_profile_test.txt");
+
+    BOOST_CHECK(loaded.Y_DC == profile.Y_DC);
+    BOOST_CHECK(loaded.Y_AC == profile.Y_AC);
+    BOOST_CHECK(loaded.C_DC == profile.C_DC);
+    BOOST_CHECK(loaded.C_AC == profile.C_AC);
+}
+
+BOOST_AUTO_TEST_CASE(table_profile_broken_files) {
+    BOOST_CHECK_THROW(loadTableProfile("does_not_exist.txt"), std::runtime_error);
+
+    // symbol 11 is missing from the Y_DC table
+    {
+        std::ofstream out("table_profile_broken.txt");
+        out << "Y_DC\n0 1 5 1 1 1 1 1 0 0 0 0 0 0 0 0\n0 1 2 3 4 5 6 7 8 9 10\n";
+    }
+    BOOST_CHECK_THROW(loadTableProfile("table_profile_broken.txt"), std::runtime_error);
+
+    // more codes than fit into 16 bits
+    {
+        std::ofstream out("table_profile_broken.txt");
+        out << "Y_DC\n3 0 0 0 0 0 0 0 0 0 0 0 0 0 0 0\n0 1 2\n";
+    }
+    BOOST_CHECK_THROW(loadTableProfile("table_profile_broken.txt"), std::runtime_error);
+}
@@ -154,6 +154,107 @@ void test_dcts(float stretch_factor)
     LogOneTransformDuration(duration, count);
 }
 
+void test_package_merge() {
+    PRINT_TEST_NAME;
+
+    // full byte alphabet with skewed frequencies, like the AC symbols of a photo
+    vector<Symbol> symbols;
+    for (int i = 0; i < 256; ++i)
+        symbols.push_back(Symbol(i, 1 + (i * 7919) % 100000 / (1 + i % 16)));
+
+    const auto count = 10000;
+    auto duration = timeFn(std::string("package merge of 256 symbols ") + std::to_string(count) + " times", [&]() {
+        for (auto i = 0; i < count; ++i)
+            package_merge(symbols, 15);
+    });
+    printf("\tOne package merge: %f ms\n", duration * 1.0 / count);
+}
+
+void test_huffman_decoding() {
+    PRINT_TEST_NAME;
+
+    // symbols with the frequencies of a typical AC table
+    vector<int> text;
+    for (unsigned int i = 0; i < 4000000; ++i)
+        text.push_back((i * 7919U) % 97 < 60 ? (i * 31U) % 8 : (i * 7919U) % 162);
+
+    auto pair = generateHuffmanCode(text);
+    auto encoded = huffmanEncode(text, pair.first);
+
+    vector<int> decoded;
+    auto duration = timeFn("decoding " + std::to_string(encoded.size() / 8) + " bytes", [&]() {
+        decoded = huffmanDecode(encoded, pair.second);
+    });
+    printf("\t%f MB/s\n", encoded.size() / 8 / 1e3 / std::max(1LL, duration));
+}
+
+void test_byte_stuffing() {
+    PRINT_TEST_NAME;
+
+    // entropy coded data has about one 0xFF in 256 bytes
+    std::vector<uint8_t> data(64 * 1024 * 1024);
+    for (auto i = 0U; i < data.size(); ++i)
+        data[i] = static_cast<uint8_t>((i * 2654435761U) >> 13);
+    std::vector<uint8_t> stuffed(2 * data.size());
+
+    size_t size = 0;
+    auto duration = timeFn("stuffing 64 MB", [&]() {
+        size = stuffBytes(data.data(), data.size(), stuffed.data());
+    });
+    printf("\t%f MB/s, %u bytes stuffed\n", 64 * 1e3 / std::max(1LL, duration), static_cast<unsigned int>(size - data.size()));
+}
+
+void test_size_estimate() {
+    PRINT_TEST_NAME;
+
+    // quantized blocks of a 2048x2048 plane, most of the high frequencies are zero
+    const uint size = 2048;
+    matrix<int> quantized(size, size);
+    for (auto i = 0U; i < quantized.data().size(); ++i) {
+        const auto row = i / size % 8, column = i % 8;
+        quantized.data()[i] = row + column < 5 ? static_cast<int>((i * 2654435761U) >> 25) - 64 : 0;
+    }
+
+    auto& dc_table = standardCodeTable(StandardTable::LuminanceDC);
+    auto& ac_table = standardCodeTable(StandardTable::LuminanceAC);
+
+    uint64_t counted = 0;
+    auto count = timeFn("counting the bits of " + std::to_string(size / 8 * size / 8) + " blocks", [&]() {
+        int previous_dc = 0;
+        for (auto h = 0U; h < size; h += 8) {
+            for (auto w = 0U; w < size; w += 8)
+                counted += blockBits(&quantized(h, w), size, previous_dc, dc_table, ac_table);
+        }
+    });
+    BitWriter stream;
+    auto encode = timeFn("huffman encoding them", [&]() {
+        int previous_dc = 0;
+        for (auto h = 0U; h < size; h += 8) {
+            for (auto w = 0U; w < size; w += 8)
+                encodeBlock(&quantized(h, w), size, previous_dc, dc_table, ac_table, stream);
+        }
+    });
+    printf("\t%llu bits counted, %llu encoded, %f times faster\n", static_cast<unsigned long long>(counted),
+           static_cast<unsigned long long>(stream.size()), encode * 1.0 / std::max(1LL, count));
+
+    // with the symbols counted once every other table is only a sum over the histograms
+    SymbolHistogram dc_histogram, ac_histogram;
+    int previous_dc = 0;
+    for (auto h = 0U; h < size; h += 8) {
+        for (auto w = 0U; w < size; w += 8) {
+            scanBlockSymbols(&quantized(h, w), size, previous_dc,
+                             [&](uint8_t symbol, CategoryBits) { ++dc_histogram[symbol]; },
+                             [&](uint8_t symbol, CategoryBits) { ++ac_histogram[symbol]; });
+        }
+    }
+    uint64_t summed = 0;
+    timeFn("the bits from the histograms 1000 times", [&]() {
+        for (int i = 0; i < 1000; ++i)
+            summed = encodedBits(dc_histogram, dc_table) + encodedBits(ac_histogram, ac_table);
+    });
+    printf("\t%llu bits\n", static_cast<unsigned long long>(summed));
+}
+
 void test_encode_draigoch() {
     PRINT_TEST_NAME;
 
@@ -178,6 +279,10 @@ int main(int argc, const char** argv)
         stretch_factor = std::stof(argv[1]);
 
     //test_dcts(stretch_factor);
+    test_package_merge();
+    test_huffman_decoding();
+    test_byte_stuffing();
+    test_size_estimate();
     test_encode_draigoch();
 
     return 0;
@@ -0,0 +1,25 @@
+#include <iostream>
+
+#include "Image.hpp"
+#include "TableProfile.hpp"
+
+// collects the huffman symbol statistics of a set of images and writes the trained tables to a profile,
+// jpgEnc uses the profile to encode similar images in one pass
+int main(int argc, char *argv[]) {
+
+    if (argc < 3) {
+        std::cout << "Usage: " << argv[0] << " <profile> <image.ppm>..." << std::endl;
+        return 0;
+    }
+
+    SymbolStatistics statistics;
+    for (int i = 2; i < argc; ++i) {
+        auto img = loadPPM(argv[i]);
+        statistics += img.collectStatistics();
+    }
+
+    saveTableProfile(trainTableProfile(statistics), argv[1]);
+    std::cout << "Trained on " << argc - 2 << " images" << std::endl;
+
+    return 0;
+}